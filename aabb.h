@@ -10,20 +10,26 @@
 #include "ray.h"
 #include "vec3.h"
 
-class aabb {
+template<typename T>
+class basic_aabb {
 public:
-    point3 minimum;
-    point3 maximum;
+    basic_vec3<T> minimum;
+    basic_vec3<T> maximum;
 
-    aabb() noexcept = default;
-    aabb(const point3 &a, const point3 &b) noexcept: minimum{a}, maximum{b} {}
+    basic_aabb() noexcept = default;
+    basic_aabb(const basic_vec3<T> &a, const basic_vec3<T> &b) noexcept: minimum{a}, maximum{b} {}
 
-    [[nodiscard]] inline bool hit(const ray &r, double t_min, double t_max) const noexcept {
+    [[nodiscard]] inline double surface_area() const noexcept {
+        const auto d = maximum - minimum;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    [[nodiscard]] inline bool hit(const basic_ray<T> &r, T t_min, T t_max) const noexcept {
         for (auto a = 0; a < 3; ++a) {
-            const auto invD = 1.0f / r.direction()[a];
+            const auto invD = T{1} / r.direction()[a];
             auto t0 = (minimum[a] - r.origin()[a]) * invD;
             auto t1 = (maximum[a] - r.origin()[a]) * invD;
-            if (invD < 0.0f)
+            if (invD < 0)
                 std::swap(t0, t1);
             t_min = t0 > t_min ? t0 : t_min;
             t_max = t1 < t_max ? t1 : t_max;
@@ -34,12 +40,15 @@ public:
     }
 };
 
-aabb surrounding_box(aabb box0, aabb box1) {
-    point3 small{std::fmin(box0.minimum.x(), box1.minimum.x()),
-                 std::fmin(box0.minimum.y(), box1.minimum.y()),
-                 std::fmin(box0.minimum.z(), box1.minimum.z())};
-    point3 big{std::fmax(box0.maximum.x(), box1.maximum.x()),
-               std::fmax(box0.maximum.y(), box1.maximum.y()),
-               std::fmax(box0.maximum.z(), box1.maximum.z())};
-    return aabb{small, big};
+using aabb = basic_aabb<real>;
+
+template<typename T>
+basic_aabb<T> surrounding_box(basic_aabb<T> box0, basic_aabb<T> box1) {
+    basic_vec3<T> small{std::fmin(box0.minimum.x(), box1.minimum.x()),
+                         std::fmin(box0.minimum.y(), box1.minimum.y()),
+                         std::fmin(box0.minimum.z(), box1.minimum.z())};
+    basic_vec3<T> big{std::fmax(box0.maximum.x(), box1.maximum.x()),
+                       std::fmax(box0.maximum.y(), box1.maximum.y()),
+                       std::fmax(box0.maximum.z(), box1.maximum.z())};
+    return basic_aabb<T>{small, big};
 }
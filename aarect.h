@@ -9,19 +9,20 @@
 #include <utility>
 
 #include "hittable.h"
+#include "material_table.h"
 
 class xy_rect final : public hittable {
 public:
-    double x0, x1, y0, y1, k;
-    shared_ptr<material> mat;
+    real x0, x1, y0, y1, k;
+    material_id mat;
 
-    xy_rect(double x0, double x1, double y0, double y1, double k, shared_ptr<material> mat) noexcept
-            : x0{x0}, x1{x1}, y0{y0}, y1{y1}, k{k}, mat{std::move(mat)} {}
+    xy_rect(real x0, real x1, real y0, real y1, real k, material_ref mat) noexcept
+            : x0{x0}, x1{x1}, y0{y0}, y1{y1}, k{k}, mat{mat.id} {}
 
     [[nodiscard]] bool hit(const ray &r,
                            double t_min,
                            double t_max,
-                           hit_record &rec) const noexcept override {
+                           hit_record &rec, rng &gen) const noexcept override {
         const auto t = (k - r.origin().z()) / r.direction().z();
         if (t < t_min || t > t_max)
             return false;
@@ -37,12 +38,37 @@ public:
 
         const vec3 outward_normal{0, 0, 1};
         rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mat;
+        rec.mat = mat;
         rec.p = r.at(t);
 
         return true;
     }
 
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        const auto t = (k - r.origin().z()) / r.direction().z();
+        if (t < t_min || t > t_max)
+            return false;
+
+        const auto x = r.origin().x() + t * r.direction().x();
+        const auto y = r.origin().y() + t * r.direction().y();
+        return !(x < x0 || x > x1 || y < y0 || y > y1);
+    }
+
+    [[nodiscard]] double pdf_value(const point3 &o, const vec3 &v, rng &gen) const noexcept override {
+        hit_record rec;
+        if (!hit(ray{o, v, 0.0}, ray_t_min, infinity, rec, gen))
+            return 0;
+
+        const auto area = (x1 - x0) * (y1 - y0);
+        const auto distance_squared = rec.t * rec.t * v.length_squared();
+        const auto cosine = std::fabs(v.dot(rec.normal) / v.length());
+        return distance_squared / (cosine * area);
+    }
+
+    [[nodiscard]] vec3 random(const point3 &o, rng &gen) const noexcept override {
+        return point3{random_double(gen, x0, x1), random_double(gen, y0, y1), k} - o;
+    }
+
     [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
         // Must have non-zero width in each dimension, so pad z with a small amount.
         output_box = aabb{point3{x0, y0, k - 1e-4}, point3{x1, y1, k + 1e-4}};
@@ -52,16 +78,16 @@ public:
 
 class xz_rect final : public hittable {
 public:
-    double x0, x1, z0, z1, k;
-    shared_ptr<material> mat;
+    real x0, x1, z0, z1, k;
+    material_id mat;
 
-    xz_rect(double x0, double x1, double z0, double z1, double k, shared_ptr<material> mat) noexcept
-    : x0{x0}, x1{x1}, z0{z0}, z1{z1}, k{k}, mat{std::move(mat)} {}
+    xz_rect(real x0, real x1, real z0, real z1, real k, material_ref mat) noexcept
+    : x0{x0}, x1{x1}, z0{z0}, z1{z1}, k{k}, mat{mat.id} {}
 
     [[nodiscard]] bool hit(const ray &r,
                            double t_min,
                            double t_max,
-                           hit_record &rec) const noexcept override {
+                           hit_record &rec, rng &gen) const noexcept override {
         const auto t = (k - r.origin().y()) / r.direction().y();
         if (t < t_min || t > t_max)
             return false;
@@ -77,12 +103,37 @@ public:
 
         const vec3 outward_normal{0, 1, 0};
         rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mat;
+        rec.mat = mat;
         rec.p = r.at(t);
 
         return true;
     }
 
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        const auto t = (k - r.origin().y()) / r.direction().y();
+        if (t < t_min || t > t_max)
+            return false;
+
+        const auto x = r.origin().x() + t * r.direction().x();
+        const auto z = r.origin().z() + t * r.direction().z();
+        return !(x < x0 || x > x1 || z < z0 || z > z1);
+    }
+
+    [[nodiscard]] double pdf_value(const point3 &o, const vec3 &v, rng &gen) const noexcept override {
+        hit_record rec;
+        if (!hit(ray{o, v, 0.0}, ray_t_min, infinity, rec, gen))
+            return 0;
+
+        const auto area = (x1 - x0) * (z1 - z0);
+        const auto distance_squared = rec.t * rec.t * v.length_squared();
+        const auto cosine = std::fabs(v.dot(rec.normal) / v.length());
+        return distance_squared / (cosine * area);
+    }
+
+    [[nodiscard]] vec3 random(const point3 &o, rng &gen) const noexcept override {
+        return point3{random_double(gen, x0, x1), k, random_double(gen, z0, z1)} - o;
+    }
+
     [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
         // Must have non-zero width in each dimension, so pad z with a small amount.
         output_box = aabb{point3{x0, k - 1e-4, z0}, point3{x1, k + 1e-4, z1}};
@@ -92,16 +143,16 @@ public:
 
 class yz_rect final : public hittable {
 public:
-    double y0, y1, z0, z1, k;
-    shared_ptr<material> mat;
+    real y0, y1, z0, z1, k;
+    material_id mat;
 
-    yz_rect(double y0, double y1, double z0, double z1, double k, shared_ptr<material> mat) noexcept
-            : y0{y0}, y1{y1}, z0{z0}, z1{z1}, k{k}, mat{std::move(mat)} {}
+    yz_rect(real y0, real y1, real z0, real z1, real k, material_ref mat) noexcept
+            : y0{y0}, y1{y1}, z0{z0}, z1{z1}, k{k}, mat{mat.id} {}
 
     [[nodiscard]] bool hit(const ray &r,
                            double t_min,
                            double t_max,
-                           hit_record &rec) const noexcept override {
+                           hit_record &rec, rng &gen) const noexcept override {
         const auto t = (k - r.origin().x()) / r.direction().x();
         if (t < t_min || t > t_max)
             return false;
@@ -117,12 +168,37 @@ public:
 
         const vec3 outward_normal{1, 0, 0};
         rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mat;
+        rec.mat = mat;
         rec.p = r.at(t);
 
         return true;
     }
 
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        const auto t = (k - r.origin().x()) / r.direction().x();
+        if (t < t_min || t > t_max)
+            return false;
+
+        const auto y = r.origin().y() + t * r.direction().y();
+        const auto z = r.origin().z() + t * r.direction().z();
+        return !(y < y0 || y > y1 || z < z0 || z > z1);
+    }
+
+    [[nodiscard]] double pdf_value(const point3 &o, const vec3 &v, rng &gen) const noexcept override {
+        hit_record rec;
+        if (!hit(ray{o, v, 0.0}, ray_t_min, infinity, rec, gen))
+            return 0;
+
+        const auto area = (y1 - y0) * (z1 - z0);
+        const auto distance_squared = rec.t * rec.t * v.length_squared();
+        const auto cosine = std::fabs(v.dot(rec.normal) / v.length());
+        return distance_squared / (cosine * area);
+    }
+
+    [[nodiscard]] vec3 random(const point3 &o, rng &gen) const noexcept override {
+        return point3{k, random_double(gen, y0, y1), random_double(gen, z0, z1)} - o;
+    }
+
     [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
         // Must have non-zero width in each dimension, so pad z with a small amount.
         output_box = aabb{point3{k - 1e-4, y0, z0}, point3{k + 1e-4, y1, z1}};
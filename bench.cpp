@@ -0,0 +1,1350 @@
+/**
+ * bench.cpp
+ * By Sebastian Raaphorst, 2023.
+ *
+ * Benchmarks for the renderer's subsystems on the built-in scenes.
+ * Run from the build directory (the earth scenes load earthmap.jpg) with the names of the benchmarks to run, or with
+ * no arguments to run all of them.
+ */
+
+#include "rtweekend.h"
+#include "bvh_builder.h"
+#include "bvh_stats.h"
+#include "integrator.h"
+#include "linear_bvh.h"
+#include "material_table.h"
+#include "motion_bvh.h"
+#include "pixel_stats.h"
+#include "primitive.h"
+#include "sampler.h"
+#include "sampling.h"
+#include "scenes.h"
+#include "wavefront.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace {
+    template<typename F>
+    double seconds(F &&f) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Trace spp paths through each pixel of a width x width view of a scene, calling fn(ray, gen) for each.
+    template<typename F>
+    void for_each_camera_ray(const scene &s, int width, int spp, F &&fn, std::uint64_t seed = 0) {
+        const auto height = static_cast<int>(width / s.aspect_ratio);
+        const auto cam = s.make_camera();
+        for (auto j = 0; j < height; ++j)
+            for (auto i = 0; i < width; ++i)
+                for (auto k = 0; k < spp; ++k) {
+                    auto gen = rng::for_sample(static_cast<std::uint64_t>(j) * width + i, k, seed);
+                    const auto u = (i + random_double(gen)) / (width - 1);
+                    const auto v = (j + random_double(gen)) / (height - 1);
+                    fn(cam.get_ray(u, v, gen), gen);
+                }
+    }
+
+    // Average path length, throughput and mean radiance with and without Russian roulette.
+    // The mean radiance should agree between the two, since roulette is unbiased.
+    void path_length() {
+        std::printf("%-20s %12s %12s %10s %10s %12s %12s\n",
+                    "scene", "length", "length(RR)", "Mrays/s", "Mrays/s(RR)", "mean", "mean(RR)");
+        for (auto which = 1; which < static_cast<int>(scene_names.size()); ++which) {
+            const material_scope scope;
+            const auto s = select_scene(which);
+
+            double length[2], rate[2], mean[2];
+            for (auto rr = 0; rr < 2; ++rr) {
+                path_limits limits;
+                limits.russian_roulette = rr == 1;
+                path_stats stats;
+                color sum{0, 0, 0};
+                const auto t = seconds([&] {
+                    for_each_camera_ray(s, 128, 16, [&](const ray &r, rng &gen) {
+                        sum += trace_path(r, s.background, s.world, limits, gen, stats);
+                    });
+                });
+                length[rr] = stats.average_length();
+                rate[rr] = static_cast<double>(stats.rays) / t * 1e-6;
+                mean[rr] = luminance(sum / static_cast<double>(stats.paths));
+            }
+
+            std::printf("%-20s %12.3f %12.3f %10.3f %10.3f %12.4f %12.4f\n",
+                        scene_names[which], length[0], length[1], rate[0], rate[1], mean[0], mean[1]);
+        }
+    }
+
+    // Throughput of the wavefront tracer against trace_path on the same camera rays, sampling the scene's lights if it
+    // has any. Both must agree exactly.
+    void wavefront() {
+        std::printf("%-20s %12s %12s %10s\n", "scene", "Mrays/s", "Mrays/s(WF)", "identical");
+        for (auto which = 1; which < static_cast<int>(scene_names.size()); ++which) {
+            const material_scope scope;
+            const auto s = select_scene(which);
+            const path_limits limits;
+            const auto lights = s.lights.empty() ? nullptr : &s.lights;
+
+            std::vector<wavefront_path> batch;
+            for_each_camera_ray(s, 128, 16, [&](const ray &r, rng &gen) {
+                batch.push_back(wavefront_path{r, gen});
+            });
+
+            path_stats scalar_stats;
+            std::vector<color> expected;
+            const auto scalar_time = seconds([&] {
+                for (auto path: batch)
+                    expected.emplace_back(trace_path(path.r, s.background, s.world, limits, path.gen, scalar_stats,
+                                                     lights));
+            });
+
+            path_stats wavefront_stats;
+            wavefront_tracer tracer{s.world, s.background, limits, lights};
+            const auto wavefront_time = seconds([&] {
+                for (std::size_t start = 0; start < batch.size(); start += 1 << 16) {
+                    std::vector<wavefront_path> chunk(batch.begin() + static_cast<std::ptrdiff_t>(start),
+                                                      batch.begin() + static_cast<std::ptrdiff_t>(
+                                                              std::min(batch.size(), start + (1 << 16))));
+                    tracer.trace(chunk, wavefront_stats);
+                    std::copy(chunk.begin(), chunk.end(), batch.begin() + static_cast<std::ptrdiff_t>(start));
+                }
+            });
+
+            auto identical = true;
+            for (std::size_t k = 0; k < batch.size(); ++k)
+                identical = identical && (batch[k].radiance - expected[k]).length_squared() == 0;
+
+            std::printf("%-20s %12.3f %12.3f %10s\n", scene_names[which],
+                        static_cast<double>(scalar_stats.rays) / scalar_time * 1e-6,
+                        static_cast<double>(wavefront_stats.rays) / wavefront_time * 1e-6,
+                        identical ? "yes" : "no");
+        }
+    }
+
+    // First-hit throughput of camera rays traced one at a time against the same rays traced in packets of
+    // ray_packet::size samples of the same pixel. Both must find the same hits.
+    void packets() {
+        std::printf("%-20s %12s %12s %8s %10s\n", "scene", "Mrays/s", "Mrays/s(P)", "speedup", "identical");
+        for (auto which = 1; which < static_cast<int>(scene_names.size()); ++which) {
+            const material_scope scope;
+            const auto s = select_scene(which);
+
+            std::vector<ray> rays;
+            std::vector<rng> gens;
+            for_each_camera_ray(s, 256, ray_packet::size, [&](const ray &r, rng &gen) {
+                rays.emplace_back(r);
+                gens.emplace_back(gen);
+            });
+
+            std::vector<hit_record> expected(rays.size());
+            std::vector<bool> expected_hit(rays.size());
+            auto scalar_gens = gens;
+            const auto scalar_time = seconds([&] {
+                for (std::size_t k = 0; k < rays.size(); ++k)
+                    expected_hit[k] = s.world.hit(rays[k], 1e-3, infinity, expected[k], scalar_gens[k]);
+            });
+
+            std::vector<hit_record> recs(rays.size());
+            std::vector<bool> hit(rays.size());
+            ray_packet packet;
+            const auto packet_time = seconds([&] {
+                for (std::size_t start = 0; start < rays.size(); start += ray_packet::size) {
+                    packet.clear();
+                    for (auto k = start; k < start + ray_packet::size; ++k)
+                        packet.add(rays[k], gens[k], recs[k], infinity);
+                    const auto mask = s.world.hit_packet(packet, packet.lanes(), 1e-3);
+                    for (auto l = 0; l < ray_packet::size; ++l)
+                        hit[start + l] = mask & (1u << l);
+                }
+            });
+
+            auto identical = true;
+            for (std::size_t k = 0; k < rays.size(); ++k)
+                identical = identical && hit[k] == expected_hit[k]
+                            && (!hit[k] || (recs[k].t == expected[k].t && recs[k].mat == expected[k].mat));
+
+            const auto n = static_cast<double>(rays.size());
+            std::printf("%-20s %12.3f %12.3f %8.2f %10s\n", scene_names[which],
+                        n / scalar_time * 1e-6, n / packet_time * 1e-6, scalar_time / packet_time,
+                        identical ? "yes" : "no");
+        }
+    }
+
+    // Bytes held by the BVHs reachable from object, counting each shared allocation's control block, and their nodes.
+    void bvh_memory(const hittable *object, std::size_t &bytes, std::size_t &nodes) {
+        constexpr std::size_t control_block = 16;
+        if (const auto n = dynamic_cast<const bvh_node*>(object)) {
+            bytes += sizeof(bvh_node) + control_block;
+            ++nodes;
+            bvh_memory(n->left.get(), bytes, nodes);
+            if (n->right != n->left)
+                bvh_memory(n->right.get(), bytes, nodes);
+        } else if (const auto l = dynamic_cast<const linear_bvh*>(object)) {
+            bytes += sizeof(linear_bvh) + control_block
+                     + l->nodes.capacity() * sizeof(linear_bvh::node)
+                     + l->primitives.capacity() * sizeof(std::shared_ptr<hittable>);
+            nodes += l->nodes.size();
+            for (const auto &p: l->primitives)
+                bvh_memory(p.get(), bytes, nodes);
+        } else if (const auto list = dynamic_cast<const hittable_list*>(object)) {
+            for (const auto &o: list->objects)
+                bvh_memory(o.get(), bytes, nodes);
+        } else if (const auto t = dynamic_cast<const translate*>(object)) {
+            bvh_memory(t->ptr.get(), bytes, nodes);
+        } else if (const auto r = dynamic_cast<const rotate_y*>(object)) {
+            bvh_memory(r->ptr.get(), bytes, nodes);
+        }
+    }
+
+    // Memory and traversal time of the pointer tree against the linear layout on final_scene: first hits of camera
+    // rays one at a time and in packets, and whole paths.
+    void linear() {
+        std::printf("%-8s %8s %10s %12s %12s %12s %8s\n",
+                    "layout", "nodes", "KiB", "Mrays/s", "Mrays/s(P)", "Mrays/s(path)", "mean");
+        for (const auto layout: {bvh_layout::tree, bvh_layout::linear}) {
+            scene_bvh = bvh_settings{layout, bvh_split::median};
+            const material_scope scope;
+            const auto s = select_scene(8);
+            scene_bvh = bvh_settings{};
+
+            std::size_t bytes = 0, nodes = 0;
+            bvh_memory(&s.world, bytes, nodes);
+
+            std::vector<ray> rays;
+            std::vector<rng> gens;
+            for_each_camera_ray(s, 256, ray_packet::size, [&](const ray &r, rng &gen) {
+                rays.emplace_back(r);
+                gens.emplace_back(gen);
+            });
+            const auto n = static_cast<double>(rays.size());
+
+            hit_record rec;
+            auto scalar_gens = gens;
+            const auto scalar_time = seconds([&] {
+                for (std::size_t k = 0; k < rays.size(); ++k)
+                    (void) s.world.hit(rays[k], 1e-3, infinity, rec, scalar_gens[k]);
+            });
+
+            std::vector<hit_record> recs(ray_packet::size);
+            ray_packet packet;
+            auto packet_gens = gens;
+            const auto packet_time = seconds([&] {
+                for (std::size_t start = 0; start < rays.size(); start += ray_packet::size) {
+                    packet.clear();
+                    for (auto k = 0; k < ray_packet::size; ++k)
+                        packet.add(rays[start + k], packet_gens[start + k], recs[k], infinity);
+                    (void) s.world.hit_packet(packet, packet.lanes(), 1e-3);
+                }
+            });
+
+            const path_limits limits;
+            path_stats stats;
+            color sum{0, 0, 0};
+            const auto path_time = seconds([&] {
+                for (std::size_t k = 0; k < rays.size(); ++k)
+                    sum += trace_path(rays[k], s.background, s.world, limits, gens[k], stats);
+            });
+
+            std::printf("%-8s %8zu %10.1f %12.3f %12.3f %12.3f %8.4f\n",
+                        layout == bvh_layout::tree ? "tree" : "linear", nodes, static_cast<double>(bytes) / 1024,
+                        n / scalar_time * 1e-6, n / packet_time * 1e-6,
+                        static_cast<double>(stats.rays) / path_time * 1e-6, luminance(sum / n));
+        }
+    }
+
+    // n small spheres scattered through a cube, viewed from outside.
+    scene sphere_cloud(int n) {
+        const auto mat = make_shared<lambertian>(color{0.5, 0.5, 0.5});
+        rng gen{static_cast<std::uint64_t>(n)};
+        const auto radius = 6.0 / std::cbrt(n);
+
+        scene s;
+        for (auto k = 0; k < n; ++k)
+            s.world.add(make_shared<sphere>(vec3::random(gen, -10, 10), radius * (0.5 + random_double(gen)), mat));
+        s.aspect_ratio = 1.0;
+        s.lookfrom = point3{0, 5, 35};
+        s.lookat = point3{0, 0, 0};
+        s.vfov = 40.0;
+        return s;
+    }
+
+    // First-hit throughput of the camera rays through a scene, one at a time and in packets, in Mrays/s.
+    std::pair<double, double> first_hit_rates(const scene &s, int width, int spp) {
+        std::vector<ray> rays;
+        std::vector<rng> gens;
+        for_each_camera_ray(s, width, spp, [&](const ray &r, rng &gen) {
+            rays.emplace_back(r);
+            gens.emplace_back(gen);
+        });
+        const auto n = static_cast<double>(rays.size());
+
+        hit_record rec;
+        auto scalar_gens = gens;
+        const auto scalar_time = seconds([&] {
+            for (std::size_t k = 0; k < rays.size(); ++k)
+                (void) s.world.hit(rays[k], 1e-3, infinity, rec, scalar_gens[k]);
+        });
+
+        std::vector<hit_record> recs(ray_packet::size);
+        ray_packet packet;
+        const auto packet_time = seconds([&] {
+            for (std::size_t start = 0; start + ray_packet::size <= rays.size(); start += ray_packet::size) {
+                packet.clear();
+                for (auto k = 0; k < ray_packet::size; ++k)
+                    packet.add(rays[start + k], gens[start + k], recs[k], infinity);
+                (void) s.world.hit_packet(packet, packet.lanes(), 1e-3);
+            }
+        });
+
+        return {n / scalar_time * 1e-6, n / packet_time * 1e-6};
+    }
+
+    // Build time and first-hit throughput of the median split against binned SAH at several leaf sizes, on clouds of
+    // spheres and on the built-in scenes with the most objects (whose build times are not shown). The median build
+    // copies its object list at every node, so it is skipped on the largest clouds.
+    void sah() {
+        std::printf("%-20s %-10s %10s %12s %12s\n", "scene", "builder", "build ms", "Mrays/s", "Mrays/s(P)");
+        const auto report = [](const char *name, const char *builder, double build, const scene &s) {
+            const auto [scalar, packet] = first_hit_rates(s, 128, ray_packet::size);
+            const auto ms = build < 0 ? std::string{"-"} : std::to_string(build * 1e3).substr(0, 8);
+            std::printf("%-20s %-10s %10s %12.3f %12.3f\n", name, builder, ms.c_str(), scalar, packet);
+        };
+
+        const std::vector<std::pair<const char*, bvh_build_options>> builders{
+                {"sah/1", {1}}, {"sah/2", {2}}, {"sah/4", {4}}, {"sah/8", {8}},
+        };
+
+        for (const auto n: {1000, 10000, 20000, 50000}) {
+            const auto cloud = sphere_cloud(n);
+            const auto name = "cloud/" + std::to_string(n);
+
+            if (n <= 20000) {
+                scene s = cloud;
+                std::shared_ptr<hittable> bvh;
+                const auto t = seconds([&] { bvh = build_bvh(cloud.world, 0, 1, bvh_split::median); });
+                s.world = hittable_list{bvh};
+                report(name.c_str(), "median", t, s);
+            }
+
+            for (const auto &[builder, options]: builders) {
+                scene s = cloud;
+                std::shared_ptr<hittable> bvh;
+                const auto t = seconds([&] { bvh = build_bvh(cloud.world, 0, 1, bvh_split::sah, options); });
+                s.world = hittable_list{bvh};
+                report(name.c_str(), builder, t, s);
+            }
+        }
+
+        for (const auto which: {1, 8}) {
+            scene_bvh = bvh_settings{bvh_layout::linear, bvh_split::median};
+            report(scene_names[which], "median", -1, select_scene(which));
+            for (const auto &[builder, options]: builders) {
+                scene_bvh = bvh_settings{bvh_layout::linear, bvh_split::sah, options};
+                report(scene_names[which], builder, -1, select_scene(which));
+            }
+            scene_bvh = bvh_settings{};
+        }
+    }
+
+    [[nodiscard]] bool same_tree(const linear_bvh &a, const linear_bvh &b) {
+        if (a.nodes.size() != b.nodes.size() || a.primitives != b.primitives)
+            return false;
+        for (std::size_t k = 0; k < a.nodes.size(); ++k) {
+            const auto &m = a.nodes[k];
+            const auto &n = b.nodes[k];
+            if (m.offset != n.offset || m.count != n.count || m.axis != n.axis
+                || (m.box.minimum - n.box.minimum).length_squared() != 0
+                || (m.box.maximum - n.box.maximum).length_squared() != 0)
+                return false;
+        }
+        return true;
+    }
+
+    // Build time against primitive count for the SAH and Morton (LBVH) builders, on one thread and on all of them,
+    // with the first-hit throughput of the result. The tree built on all threads must match the one-thread tree.
+    void build() {
+        // At least a few threads, so that the forked builds are exercised even where they cannot run in parallel.
+        const auto threads = std::max(4u, std::thread::hardware_concurrency());
+        std::printf("%-10s %-8s %12s %12s %10s %12s\n",
+                    "prims", "builder", "1 thread ms", "N threads ms", "identical", "Mrays/s");
+        for (const auto n: {1000, 10000, 100000, 1000000}) {
+            const auto cloud = sphere_cloud(n);
+            for (const auto split: {bvh_split::sah, bvh_split::morton}) {
+                std::shared_ptr<linear_bvh> serial, parallel;
+                const auto serial_time = seconds([&] {
+                    serial = build_bvh(cloud.world, 0, 1, split, bvh_build_options{.threads = 1});
+                });
+                const auto parallel_time = seconds([&] {
+                    parallel = build_bvh(cloud.world, 0, 1, split, bvh_build_options{.threads = threads});
+                });
+
+                scene s = cloud;
+                s.world = hittable_list{parallel};
+                const auto rate = first_hit_rates(s, 64, ray_packet::size).first;
+                std::printf("%-10d %-8s %12.1f %12.1f %10s %12.3f\n", n, split == bvh_split::sah ? "sah" : "morton",
+                            serial_time * 1e3, parallel_time * 1e3,
+                            same_tree(*serial, *parallel) ? "yes" : "no", rate);
+            }
+        }
+        std::printf("(N = %u)\n", threads);
+    }
+
+    // The BVH report of every scene under every builder, as a JSON array, for tracking tree quality over time.
+    void bvh_stats() {
+        const std::vector<std::pair<const char*, bvh_split>> builders{
+                {"median", bvh_split::median}, {"sah", bvh_split::sah}, {"morton", bvh_split::morton},
+        };
+
+        std::printf("[");
+        auto first = true;
+        for (const auto &[builder, split]: builders) {
+            scene_bvh = bvh_settings{bvh_layout::linear, split};
+            for (auto which = 1; which < static_cast<int>(scene_names.size()); ++which) {
+                const material_scope scope;
+                const auto s = select_scene(which);
+                std::vector<ray> rays;
+                for_each_camera_ray(s, 128, 1, [&](const ray &r, rng &) { rays.emplace_back(r); });
+
+                std::ostringstream out;
+                out << "{\"builder\": \"" << builder << "\", \"report\": ";
+                (void) write_bvh_report(out, s.name, s.world, rays);
+                out << '}';
+                std::printf("%s\n%s", first ? "" : ",", out.str().c_str());
+                first = false;
+            }
+        }
+        scene_bvh = bvh_settings{};
+        std::printf("\n]\n");
+    }
+
+    // Throughput of the binary BVH against the 4- and 8-wide ones: first hits of camera rays, one at a time and in
+    // packets, and whole paths, whose diffuse bounces are incoherent. The paths' mean radiance must agree.
+    void wide() {
+        std::printf("%-14s %-7s %10s %12s %12s %13s %8s\n",
+                    "scene", "layout", "KiB", "Mrays/s", "Mrays/s(P)", "Mrays/s(path)", "mean");
+        const std::vector<std::pair<const char*, bvh_layout>> layouts{
+                {"linear", bvh_layout::linear}, {"wide4", bvh_layout::wide4}, {"wide8", bvh_layout::wide8},
+        };
+
+        for (const auto which: {1, 6, 8}) {
+            for (const auto &[name, layout]: layouts) {
+                scene_bvh = bvh_settings{layout};
+                const material_scope scope;
+                const auto s = select_scene(which);
+                scene_bvh = bvh_settings{};
+
+                std::size_t bytes = 0;
+                std::vector<const hittable*> pending{&s.world};
+                while (!pending.empty()) {
+                    const auto object = pending.back();
+                    pending.pop_back();
+                    if (const auto l = dynamic_cast<const linear_bvh*>(object))
+                        bytes += l->nodes.capacity() * sizeof(linear_bvh::node);
+                    else if (const auto w4 = dynamic_cast<const wide_bvh<4>*>(object))
+                        bytes += w4->nodes.capacity() * sizeof(wide_bvh<4>::node);
+                    else if (const auto w8 = dynamic_cast<const wide_bvh<8>*>(object))
+                        bytes += w8->nodes.capacity() * sizeof(wide_bvh<8>::node);
+                    else if (const auto list = dynamic_cast<const hittable_list*>(object))
+                        for (const auto &o: list->objects)
+                            pending.emplace_back(o.get());
+                }
+
+                const auto [scalar, packet] = first_hit_rates(s, 128, ray_packet::size);
+
+                const path_limits limits;
+                path_stats stats;
+                color sum{0, 0, 0};
+                const auto t = seconds([&] {
+                    for_each_camera_ray(s, 128, 8, [&](const ray &r, rng &gen) {
+                        sum += trace_path(r, s.background, s.world, limits, gen, stats);
+                    });
+                });
+
+                std::printf("%-14s %-7s %10.1f %12.3f %12.3f %13.3f %8.4f\n", scene_names[which], name,
+                            static_cast<double>(bytes) / 1024, scalar, packet,
+                            static_cast<double>(stats.rays) / t * 1e-6,
+                            luminance(sum / static_cast<double>(stats.paths)));
+            }
+        }
+    }
+
+    // What hit records used to pay for their shared_ptr<material>: every candidate hit copy-assigned it, an atomic
+    // increment and decrement on the material's control block, against the raw handle they now carry. Threads
+    // assign handles to the same four materials, as they would when tracing the same scene.
+    void handles() {
+        static_assert(std::is_trivially_copyable_v<hit_record>, "hit records must not own their materials");
+
+        const std::vector<std::shared_ptr<material>> materials{
+                make_shared<lambertian>(color{0.65, 0.05, 0.05}), make_shared<lambertian>(color{0.73, 0.73, 0.73}),
+                make_shared<lambertian>(color{0.12, 0.45, 0.15}), make_shared<diffuse_light>(color{15, 15, 15}),
+        };
+        constexpr auto assignments = 1 << 24;
+
+        std::printf("%-8s %16s %16s\n", "threads", "shared_ptr ns", "raw ns");
+        for (const auto threads: {1u, 2u, 4u}) {
+            std::atomic<std::uintptr_t> sink{0};
+            const auto run = [&](auto assign) {
+                return seconds([&] {
+                    std::vector<std::jthread> workers;
+                    for (auto t = 0u; t < threads; ++t)
+                        workers.emplace_back([&, t] { sink += assign(t); });
+                }) / assignments * 1e9;
+            };
+
+            const auto owning = run([&](unsigned t) {
+                std::shared_ptr<material> handle;
+                for (auto k = 0; k < assignments; ++k)
+                    handle = materials[(k + t) & 3];
+                return reinterpret_cast<std::uintptr_t>(handle.get());
+            });
+            const auto raw = run([&](unsigned t) {
+                const material *handle = nullptr;
+                for (auto k = 0; k < assignments; ++k) {
+                    handle = materials[(k + t) & 3].get();
+                    asm volatile("" : "+r"(handle));
+                }
+                return reinterpret_cast<std::uintptr_t>(handle);
+            });
+            std::printf("%-8u %16.3f %16.3f\n", threads, owning, raw);
+        }
+    }
+
+    // Spheres intersected one object at a time against sphere_sets in the BVH leaves, built with several leaf sizes
+    // and node costs: first hits of camera rays, one at a time and in packets, and whole paths.
+    void spheres() {
+        std::printf("%-14s %-18s %12s %12s %13s %8s\n", "scene", "spheres", "Mrays/s", "Mrays/s(P)", "Mrays/s(path)",
+                    "mean");
+        struct variant final {
+            const char *name;
+            bool pack;
+            bvh_build_options options;
+        };
+        const std::vector<variant> variants{
+                {"objects", false, {}},
+                {"sets leaf4", true, {4}},
+                {"sets leaf8", true, {8}},
+                {"sets leaf8 cost2", true, {8, 16, 2.0}},
+                {"sets leaf8 cost4", true, {8, 16, 4.0}},
+        };
+
+        for (const auto which: {1, 8, 0}) {
+            for (const auto &v: variants) {
+                const material_scope scope;
+                scene s;
+                if (which > 0) {
+                    scene_bvh = bvh_settings{bvh_layout::linear, bvh_split::sah, v.options, v.pack};
+                    s = select_scene(which);
+                    scene_bvh = bvh_settings{};
+                } else {
+                    s = sphere_cloud(10000);
+                    auto bvh = build_bvh(s.world, 0, 1, bvh_split::sah, v.options);
+                    s.world = hittable_list{v.pack ? pack_spheres(*bvh) : bvh};
+                }
+
+                const auto [scalar, packet] = first_hit_rates(s, 128, ray_packet::size);
+
+                const path_limits limits;
+                path_stats stats;
+                color sum{0, 0, 0};
+                const auto t = seconds([&] {
+                    for_each_camera_ray(s, 128, 8, [&](const ray &r, rng &gen) {
+                        sum += trace_path(r, s.background, s.world, limits, gen, stats);
+                    });
+                });
+
+                std::printf("%-14s %-18s %12.3f %12.3f %13.3f %8.4f\n", which > 0 ? s.name : "cloud/10000", v.name,
+                            scalar, packet, static_cast<double>(stats.rays) / t * 1e-6,
+                            luminance(sum / static_cast<double>(stats.paths)));
+            }
+        }
+    }
+
+    // Forwards to a BVH's counted traversal, so that every ray of a path is counted.
+    template<typename Bvh>
+    class counted_bvh final : public hittable {
+    public:
+        const Bvh &bvh;
+        mutable linear_bvh::traversal_stats stats;
+
+        explicit counted_bvh(const Bvh &bvh) noexcept : bvh{bvh} {}
+
+        [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec,
+                               rng &gen) const noexcept override {
+            return bvh.hit(r, t_min, t_max, rec, gen, stats);
+        }
+
+        [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
+            return bvh.bounding_box(time0, time1, output_box);
+        }
+    };
+
+    // A sphere_cloud whose spheres move by 2 units, several times their radius, during the shutter interval.
+    scene streaks(int n) {
+        auto s = sphere_cloud(n);
+        rng gen{static_cast<std::uint64_t>(n) + 1};
+        hittable_list moving;
+        for (const auto &object: s.world.objects) {
+            const auto &sp = dynamic_cast<const sphere&>(*object);
+            moving.add(make_shared<moving_sphere>(sp.center, sp.center + 2 * random_unit_vector(gen), 0.0, 1.0,
+                                                  sp.radius, sp.mat));
+        }
+        s.name = "streaks";
+        s.world = hittable_list{make_bvh(moving, 0.0, 1.0)};
+        return s;
+    }
+
+    // Traversal work and throughput of whole paths through the outermost BVH of the scenes with moving spheres, with
+    // the primitives bounded over the whole shutter interval and at several numbers of time keys.
+    void motion() {
+        std::printf("%-14s %-6s %12s %12s %12s %13s %8s\n", "scene", "keys", "nodes/ray", "prims/ray", "Mrays/s",
+                    "Mrays/s(path)", "mean");
+        for (const auto which: {1, 8, 0}) {
+            for (const auto keys: {0, 2, 3, 5}) {
+                scene_bvh.motion_keys = keys;
+                const material_scope scope;
+                auto s = which > 0 ? select_scene(which) : streaks(10000);
+                scene_bvh = bvh_settings{};
+
+                const auto outer = s.world.objects.front().get();
+                linear_bvh::traversal_stats stats;
+                const auto count = [&](const auto &bvh) {
+                    const auto counted = make_shared<counted_bvh<std::remove_cvref_t<decltype(bvh)>>>(bvh);
+                    scene c = s;
+                    c.world = hittable_list{counted};
+                    const path_limits limits;
+                    path_stats paths;
+                    for_each_camera_ray(c, 128, 8, [&](const ray &r, rng &gen) {
+                        (void) trace_path(r, c.background, c.world, limits, gen, paths);
+                    });
+                    stats = counted->stats;
+                };
+                if (const auto m = dynamic_cast<const motion_bvh*>(outer))
+                    count(*m);
+                else
+                    count(dynamic_cast<const linear_bvh&>(*outer));
+
+                // The best of three runs, since the differences are small.
+                const path_limits limits;
+                path_stats paths;
+                color sum{0, 0, 0};
+                auto t = infinity;
+                auto first = 0.0;
+                for (auto run = 0; run < 3; ++run) {
+                    paths = path_stats{};
+                    sum = color{0, 0, 0};
+                    t = std::min(t, seconds([&] {
+                        for_each_camera_ray(s, 128, 8, [&](const ray &r, rng &gen) {
+                            sum += trace_path(r, s.background, s.world, limits, gen, paths);
+                        });
+                    }));
+                    first = std::max(first, first_hit_rates(s, 128, ray_packet::size).first);
+                }
+
+                const auto rays = static_cast<double>(stats.rays);
+                std::printf("%-14s %-6d %12.2f %12.2f %12.3f %13.3f %8.4f\n", s.name, keys,
+                            static_cast<double>(stats.node_visits) / rays,
+                            static_cast<double>(stats.primitive_tests) / rays, first,
+                            static_cast<double>(paths.rays) / t * 1e-6,
+                            luminance(sum / static_cast<double>(paths.paths)));
+            }
+        }
+    }
+
+    // Path throughput in this build's precision, and the error of its images against those of the double build. Each
+    // build saves its images as precision_<scene>_<float|double>.bin, so run ./bench precision first, and then
+    // ./bench_float precision to compare. The RMSE of a second double render with other random numbers is the noise
+    // floor: paths that part ways through rounding differ by about that much, so only error well above it is bias.
+    void precision() {
+        constexpr auto width = 160;
+        constexpr auto spp = 16;
+        const auto precision = std::is_same_v<real, float> ? "float" : "double";
+        std::printf("%-14s %-7s %13s %8s %10s %10s %10s\n", "scene", "real", "Mrays/s(path)", "mean", "rmse", "noise",
+                    "bad");
+
+        for (const auto which: {1, 6, 8}) {
+            const material_scope scope;
+            const auto s = select_scene(which);
+            const auto height = static_cast<int>(width / s.aspect_ratio);
+            const auto pixels = static_cast<std::size_t>(width) * height;
+
+            const auto render = [&](std::uint64_t seed, path_stats &stats) {
+                const path_limits limits;
+                std::vector<double> image(3 * pixels, 0.0);
+                std::size_t n = 0;
+                for_each_camera_ray(s, width, spp, [&](const ray &r, rng &gen) {
+                    const auto c = trace_path(r, s.background, s.world, limits, gen, stats);
+                    for (auto a = 0; a < 3; ++a)
+                        image[3 * (n / spp) + a] += static_cast<double>(c[a]) / spp;
+                    ++n;
+                }, seed);
+                return image;
+            };
+            const auto rmse = [](const std::vector<double> &a, const std::vector<double> &b) {
+                auto sum = 0.0;
+                for (std::size_t k = 0; k < a.size(); ++k)
+                    sum += (a[k] - b[k]) * (a[k] - b[k]);
+                return std::sqrt(sum / static_cast<double>(a.size()));
+            };
+
+            path_stats stats;
+            std::vector<double> image;
+            const auto t = seconds([&] { image = render(0, stats); });
+
+            // Pixels that are not finite: rays that slipped through surfaces or NaNs from degenerate geometry.
+            std::size_t bad = 0;
+            auto mean = 0.0;
+            for (std::size_t k = 0; k < image.size(); k += 3) {
+                if (!std::isfinite(image[k] + image[k + 1] + image[k + 2]))
+                    ++bad;
+                else
+                    mean += luminance(color{image[k], image[k + 1], image[k + 2]}) / static_cast<double>(pixels);
+            }
+
+            const auto file = std::string{"precision_"} + s.name + "_";
+            if (std::FILE *out = std::fopen((file + precision + ".bin").c_str(), "wb")) {
+                std::fwrite(image.data(), sizeof(double), image.size(), out);
+                std::fclose(out);
+            }
+
+            std::vector<double> reference(image.size());
+            auto have_reference = false;
+            if (std::FILE *in = std::fopen((file + "double.bin").c_str(), "rb")) {
+                have_reference = std::fread(reference.data(), sizeof(double), reference.size(), in) == reference.size();
+                std::fclose(in);
+            }
+
+            path_stats noise_stats;
+            const auto noise = rmse(reference, render(1, noise_stats));
+            const auto error = have_reference ? rmse(reference, image) : std::nan("");
+            std::printf("%-14s %-7s %13.3f %8.4f %10.5f %10.5f %10zu\n", s.name, precision,
+                        static_cast<double>(stats.rays) / t * 1e-6, mean, error, have_reference ? noise : std::nan(""),
+                        bad);
+        }
+    }
+
+    // The core vector operations over arrays of vectors, in ns per operation, and whole frames: path throughput and
+    // mean radiance, the best of three runs. Compare ./bench vec3 with ./bench_simd vec3, which stores the vectors in
+    // SIMD registers.
+    void vec3_ops() {
+        std::printf("vec3: %s, %zu bytes\n", vec3_lanes<real>::enabled ? "simd" : "scalar", sizeof(vec3));
+
+        constexpr std::size_t n = 4096;
+        constexpr auto rounds = 2000;
+        rng gen{7};
+        std::vector<vec3> a(n), b(n), out(n);
+        for (std::size_t k = 0; k < n; ++k) {
+            a[k] = vec3::random(gen, -1, 1);
+            b[k] = vec3::random(gen, -1, 1);
+        }
+
+        const auto time_op = [&](const char *name, auto &&op) {
+            auto best = infinity;
+            for (auto run = 0; run < 3; ++run)
+                best = std::min(best, seconds([&] {
+                    for (auto r = 0; r < rounds; ++r) {
+                        for (std::size_t k = 0; k < n; ++k)
+                            op(k);
+                        // Keep the compiler from folding the rounds into one.
+                        std::atomic_signal_fence(std::memory_order_seq_cst);
+                    }
+                }));
+            std::printf("%-14s %8.3f ns\n", name, best / (static_cast<double>(n) * rounds) * 1e9);
+        };
+        real sum = 0;
+        time_op("add", [&](std::size_t k) { out[k] = a[k] + b[k]; });
+        time_op("scale", [&](std::size_t k) { out[k] = 0.5 * a[k]; });
+        time_op("dot", [&](std::size_t k) { sum += a[k].dot(b[k]); });
+        time_op("cross", [&](std::size_t k) { out[k] = a[k].cross(b[k]); });
+        time_op("length", [&](std::size_t k) { sum += a[k].length(); });
+        time_op("unit_vector", [&](std::size_t k) { out[k] = a[k].unit_vector(); });
+        time_op("reflect", [&](std::size_t k) { out[k] = reflect(a[k], b[k]); });
+        std::printf("(checksum %g)\n\n", static_cast<double>(sum + out[n / 2].x()));
+
+        std::printf("%-14s %13s %8s\n", "scene", "Mrays/s(path)", "mean");
+        for (const auto which: {1, 6, 8}) {
+            const material_scope scope;
+            const auto s = select_scene(which);
+            const path_limits limits;
+            path_stats stats;
+            color total{0, 0, 0};
+            auto t = infinity;
+            for (auto run = 0; run < 3; ++run) {
+                stats = path_stats{};
+                total = color{0, 0, 0};
+                t = std::min(t, seconds([&] {
+                    for_each_camera_ray(s, 128, 8, [&](const ray &r, rng &g) {
+                        total += trace_path(r, s.background, s.world, limits, g, stats);
+                    });
+                }));
+            }
+            std::printf("%-14s %13.3f %8.4f\n", s.name, static_cast<double>(stats.rays) / t * 1e-6,
+                        luminance(total / static_cast<double>(stats.paths)));
+        }
+    }
+
+    // Virtual calls on shared_ptr<hittable> against switch dispatch on primitives stored by value: the time per call
+    // of intersecting rays with every primitive of a scene's BVH in turn, the memory of the primitives, and the
+    // throughput of first hits and of whole paths through the BVHs.
+    void by_value() {
+        std::printf("%-14s %-8s %10s %10s %12s %13s %8s\n", "scene", "storage", "ns/call", "KiB prims", "Mrays/s",
+                    "Mrays/s(path)", "mean");
+        for (const auto which: {1, 6, 7, 8, 0}) {
+            for (const auto value: {false, true}) {
+                const material_scope scope;
+                scene s;
+                if (which > 0) {
+                    scene_bvh.by_value = value;
+                    s = select_scene(which);
+                    scene_bvh = bvh_settings{};
+                } else {
+                    s = sphere_cloud(10000);
+                    const auto bvh = build_bvh(s.world, 0, 1);
+                    s.world = value ? hittable_list{make_shared<primitive_bvh>(*bvh)} : hittable_list{bvh};
+                }
+
+                // The primitives of the outermost BVH, as they are stored.
+                const auto outer = s.world.objects.front().get();
+                static const std::vector<primitive> no_values;
+                static const std::vector<std::shared_ptr<hittable>> no_pointers;
+                const auto by_value = dynamic_cast<const primitive_bvh*>(outer);
+                const auto &values = by_value ? by_value->primitives : no_values;
+                const auto &pointers = by_value ? no_pointers : dynamic_cast<const linear_bvh&>(*outer).primitives;
+
+                // A primitive behind a shared_ptr made by make_shared shares its allocation with a control block of
+                // two pointers and two counts.
+                std::size_t bytes = values.capacity() * sizeof(primitive) + pointers.capacity() * sizeof(pointers[0]);
+                for (const auto &object: pointers)
+                    bytes += std::visit([](const auto &o) { return sizeof(o); }, make_primitive(object)) + 24;
+
+                std::vector<ray> rays;
+                for_each_camera_ray(s, 16, 1, [&](const ray &r, rng &) { rays.emplace_back(r); });
+                rng gen{0};
+                hit_record rec;
+                std::size_t calls = 0, hits = 0;
+                const auto t = seconds([&] {
+                    for (const auto &r: rays) {
+                        for (const auto &p: values)
+                            hits += hit(p, r, ray_t_min, infinity, rec, gen);
+                        for (const auto &p: pointers)
+                            hits += p->hit(r, ray_t_min, infinity, rec, gen);
+                        calls += values.size() + pointers.size();
+                    }
+                });
+
+                const auto [first, _] = first_hit_rates(s, 128, ray_packet::size);
+                const path_limits limits;
+                path_stats stats;
+                color total{0, 0, 0};
+                const auto path_time = seconds([&] {
+                    for_each_camera_ray(s, 128, 8, [&](const ray &r, rng &g) {
+                        total += trace_path(r, s.background, s.world, limits, g, stats);
+                    });
+                });
+
+                std::printf("%-14s %-8s %10.2f %10.1f %12.3f %13.3f %8.4f\n", which > 0 ? s.name : "cloud/10000",
+                            value ? "value" : "pointer", t / static_cast<double>(calls) * 1e9,
+                            static_cast<double>(bytes) / 1024, first,
+                            static_cast<double>(stats.rays) / path_time * 1e-6,
+                            luminance(total / static_cast<double>(stats.paths)));
+                if (hits == 0)
+                    std::printf("(no hits)\n");
+            }
+        }
+    }
+
+    // Visibility queries answered by occluded, which stops at the first hit and fills in no record, against hit, which
+    // finds the closest one. The segments run from the first hits of camera rays to random points at the scale of the
+    // scene, as shadow rays to lights would. Both must agree on every segment, except through media, whose hits are
+    // random and which the two draw from in different orders.
+    void occlusion() {
+        std::printf("%-14s %-8s %12s %14s %10s %10s\n", "scene", "layout", "Mrays/s(hit)", "Mrays/s(occl)",
+                    "occluded", "disagree");
+        struct layout final {
+            const char *name;
+            bvh_settings settings;
+        };
+        const std::vector<layout> layouts{
+                {"tree", bvh_settings{bvh_layout::tree}}, {"linear", bvh_settings{}},
+                {"wide8", bvh_settings{bvh_layout::wide8}},
+                {"value", bvh_settings{.by_value = true}}, {"motion", bvh_settings{.motion_keys = 4}},
+        };
+
+        for (const auto which: {1, 5, 6, 7, 8}) {
+            for (const auto &l: layouts) {
+                scene_bvh = l.settings;
+                const material_scope scope;
+                const auto s = select_scene(which);
+                scene_bvh = bvh_settings{};
+
+                const auto scale = (s.lookat - s.lookfrom).length();
+                std::vector<ray> segments;
+                for_each_camera_ray(s, 128, 1, [&](const ray &r, rng &gen) {
+                    hit_record rec;
+                    if (s.world.hit(r, ray_t_min, infinity, rec, gen))
+                        segments.emplace_back(rec.p, scale * random_unit_vector(gen), r.time());
+                });
+
+                std::array<double, 2> rate{};
+                std::size_t blocked = 0, disagree = 0;
+                for (auto round = 0; round < 3; ++round) {
+                    std::vector<char> by_hit(segments.size());
+                    std::vector<char> by_occluded(segments.size());
+                    rng gen{0};
+                    const auto hit_time = seconds([&] {
+                        for (std::size_t k = 0; k < segments.size(); ++k) {
+                            hit_record rec;
+                            by_hit[k] = s.world.hit(segments[k], ray_t_min, 1, rec, gen);
+                        }
+                    });
+                    gen = rng{0};
+                    const auto occluded_time = seconds([&] {
+                        for (std::size_t k = 0; k < segments.size(); ++k)
+                            by_occluded[k] = s.world.occluded(segments[k], ray_t_min, 1, gen);
+                    });
+                    rate[0] = std::max(rate[0], static_cast<double>(segments.size()) / hit_time * 1e-6);
+                    rate[1] = std::max(rate[1], static_cast<double>(segments.size()) / occluded_time * 1e-6);
+
+                    blocked = disagree = 0;
+                    for (std::size_t k = 0; k < segments.size(); ++k) {
+                        blocked += by_occluded[k];
+                        disagree += by_hit[k] != by_occluded[k];
+                    }
+                }
+
+                std::printf("%-14s %-8s %12.3f %14.3f %9.1f%% %10zu\n", s.name, l.name, rate[0], rate[1],
+                            100.0 * static_cast<double>(blocked) / static_cast<double>(segments.size()), disagree);
+            }
+        }
+    }
+
+    // The mean of spp paths through each pixel of a width-wide view of a scene, in rows from the bottom, with the
+    // samples spread by a sampler of the given kind. With independent samples, the paths are those of
+    // for_each_camera_ray.
+    [[nodiscard]] std::vector<color> render(const scene &s, int width, int spp, std::uint64_t seed,
+                                            const light_list *lights, bool mis = true,
+                                            sampler_kind kind = sampler_kind::independent) {
+        const path_limits limits;
+        path_stats stats;
+        const auto height = static_cast<int>(width / s.aspect_ratio);
+        const auto cam = s.make_camera();
+        const sampler pixel_sampler{kind, spp, seed};
+        std::vector<color> pixels;
+        for (auto j = 0; j < height; ++j)
+            for (auto i = 0; i < width; ++i) {
+                const auto pixel = static_cast<std::uint64_t>(j) * width + i;
+                pixels.emplace_back(0, 0, 0);
+                for (auto k = 0; k < spp; ++k) {
+                    auto gen = rng::for_sample(pixel, k, seed);
+                    auto point = pixel_sampler.start(pixel, k);
+                    const auto jitter = point.get_2d(gen);
+                    const auto u = (i + jitter[0]) / (width - 1);
+                    const auto v = (j + jitter[1]) / (height - 1);
+                    const auto lens = point.get_2d(gen);
+                    const auto r = cam.get_ray(u, v, lens, point.get_1d(gen));
+                    pixels.back() += trace_path(r, s.background, s.world, limits, gen, stats, lights, mis,
+                                                &point) / spp;
+                }
+            }
+        return pixels;
+    }
+
+    // The root mean square difference in luminance between the pixels of two images.
+    [[nodiscard]] double rmse(const std::vector<color> &image, const std::vector<color> &reference) {
+        auto sum = 0.0;
+        for (std::size_t k = 0; k < image.size(); ++k) {
+            const auto d = luminance(image[k]) - luminance(reference[k]);
+            sum += d * d;
+        }
+        return std::sqrt(sum / static_cast<double>(image.size()));
+    }
+
+    // Next-event estimation against paths that only find the lights by bouncing into them: the error of each against
+    // a reference rendered with many samples, and the samples and time that paths without it need for the same error,
+    // taking the error to fall with the square root of the samples. The means agree, since both are unbiased.
+    void next_event() {
+        constexpr auto width = 48;
+        constexpr auto reference_spp = 2048;
+        std::printf("%-14s %6s %6s %10s %10s %8s %8s %11s %12s\n", "scene", "lights", "spp", "rmse", "rmse(NEE)",
+                    "s", "s(NEE)", "spp ratio", "time ratio");
+        for (const auto which: {5, 6, 7, 8}) {
+            const material_scope scope;
+            const auto s = select_scene(which);
+            const auto reference = render(s, width, reference_spp, 1, &s.lights, false);
+
+            for (const auto spp: {4, 16, 64}) {
+                std::vector<color> plain, nee;
+                const auto plain_time = seconds([&] { plain = render(s, width, spp, 0, nullptr); });
+                const auto nee_time = seconds([&] { nee = render(s, width, spp, 0, &s.lights, false); });
+                const auto plain_error = rmse(plain, reference);
+                const auto nee_error = rmse(nee, reference);
+                const auto spp_ratio = (plain_error * plain_error) / (nee_error * nee_error);
+                std::printf("%-14s %6zu %6d %10.4f %10.4f %8.2f %8.2f %10.1fx %11.1fx\n", s.name,
+                            s.lights.lights.size(), spp, plain_error, nee_error, plain_time, nee_time, spp_ratio,
+                            spp_ratio * plain_time / nee_time);
+            }
+
+            // The means of the two estimators, against the reference.
+            const auto mean = [](const std::vector<color> &image) {
+                color sum{0, 0, 0};
+                for (const auto &c: image)
+                    sum += c;
+                return luminance(sum / static_cast<double>(image.size()));
+            };
+            std::printf("%-14s mean %.4f, mean(NEE, %d spp) %.4f, mean(no NEE, 256 spp) %.4f\n", s.name,
+                        mean(reference), reference_spp, mean(render(s, width, 256, 2, &s.lights, false)),
+                        mean(render(s, width, 256, 2, nullptr)));
+        }
+    }
+
+    // The Cornell box with a large light and a metal floor of the given fuzz, where light samples do poorly: the
+    // floor reflects the light in a small lobe, that few samples on the light fall into.
+    scene glossy_box(double fuzz) {
+        auto s = select_scene(6);
+        hittable_list objects;
+        const auto red   = make_shared<lambertian>(color{.65, .05, .05});
+        const auto white = make_shared<lambertian>(color{.73, .73, .73});
+        const auto green = make_shared<lambertian>(color{.12, .45, .15});
+        const auto light = make_shared<diffuse_light>(color{4, 4, 4});
+        const auto floor = make_shared<metal>(color{.8, .8, .8}, fuzz);
+
+        objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+        objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+        objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
+        objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, floor));
+        objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+        objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+        objects.add(make_shared<sphere>(point3{190, 90, 190}, 90, white));
+
+        s.name = fuzz < 0.1 ? "glossy_0.05" : fuzz < 0.3 ? "glossy_0.2" : "glossy_0.5";
+        s.world = hittable_list{make_bvh(objects)};
+        s.lights = light_list{s.world};
+        return s;
+    }
+
+    // Multiple importance sampling against next-event estimation alone, and against paths without either: the error
+    // of each against a reference rendered with many samples using multiple importance sampling, the time each takes,
+    // and the means, which agree since all three are unbiased.
+    void mis() {
+        constexpr auto width = 48;
+        constexpr auto reference_spp = 2048;
+        constexpr auto spp = 16;
+        std::printf("%-14s %10s %10s %10s %8s %8s %8s %10s %10s %10s %10s\n", "scene", "rmse", "rmse(NEE)",
+                    "rmse(MIS)", "s", "s(NEE)", "s(MIS)", "mean(ref)", "mean", "mean(NEE)", "mean(MIS)");
+        std::vector<scene> scenes;
+        for (const auto which: {5, 6, 7, 8})
+            scenes.emplace_back(select_scene(which));
+        for (const auto fuzz: {0.05, 0.2, 0.5})
+            scenes.emplace_back(glossy_box(fuzz));
+
+        const auto mean = [](const std::vector<color> &image) {
+            color sum{0, 0, 0};
+            for (const auto &c: image)
+                sum += c;
+            return luminance(sum / static_cast<double>(image.size()));
+        };
+        for (const auto &s: scenes) {
+            const auto reference = render(s, width, reference_spp, 1, &s.lights, true);
+            std::array<std::vector<color>, 3> images;
+            std::array<double, 3> time{infinity, infinity, infinity};
+            for (auto round = 0; round < 3; ++round) {
+                time[0] = std::min(time[0], seconds([&] { images[0] = render(s, width, spp, 0, nullptr); }));
+                time[1] = std::min(time[1], seconds([&] { images[1] = render(s, width, spp, 0, &s.lights, false); }));
+                time[2] = std::min(time[2], seconds([&] { images[2] = render(s, width, spp, 0, &s.lights, true); }));
+            }
+            std::printf("%-14s %10.4f %10.4f %10.4f %8.3f %8.3f %8.3f %10.4f %10.4f %10.4f %10.4f\n", s.name,
+                        rmse(images[0], reference), rmse(images[1], reference), rmse(images[2], reference),
+                        time[0], time[1], time[2], mean(reference), mean(images[0]), mean(images[1]),
+                        mean(images[2]));
+        }
+    }
+
+    // A material of class M that the material table cannot flatten, so that it is shaded through virtual calls as all
+    // materials were before the table. The calls into inner are not virtual.
+    template<typename M>
+    struct opaque_material final : material {
+        M inner;
+
+        template<typename... Args>
+        explicit opaque_material(Args&&... args): inner{std::forward<Args>(args)...} {}
+
+        [[nodiscard]] bool scatter(const ray &r_in,
+                                   const hit_record &rec,
+                                   color &attenuation,
+                                   ray &scattered,
+                                   rng &gen) const noexcept override {
+            return inner.M::scatter(r_in, rec, attenuation, scattered, gen);
+        }
+
+        [[nodiscard]] color emitted(double u, double v, point3 &p) const noexcept override {
+            return inner.M::emitted(u, v, p);
+        }
+
+        [[nodiscard]] bounce_type bounce() const noexcept override {
+            return inner.M::bounce();
+        }
+    };
+
+    // The polymorphic material that a record was flattened from.
+    [[nodiscard]] std::shared_ptr<material> opaque(const material_record &m) {
+        // The table keeps the texture alive.
+        const auto tex = m.tex ? std::shared_ptr<texture>{std::shared_ptr<texture>{}, const_cast<texture*>(m.tex)}
+                               : std::shared_ptr<texture>{make_shared<solid_color>(m.albedo)};
+        switch (m.kind) {
+            case material_kind::lambertian: return make_shared<opaque_material<lambertian>>(tex);
+            case material_kind::metal: return make_shared<opaque_material<metal>>(m.albedo, m.parameter);
+            case material_kind::dielectric: return make_shared<opaque_material<dielectric>>(m.parameter);
+            case material_kind::diffuse_light: return make_shared<opaque_material<diffuse_light>>(tex);
+            case material_kind::isotropic: return make_shared<opaque_material<isotropic>>(tex);
+            default: return {std::shared_ptr<material>{}, const_cast<material*>(m.object)};
+        }
+    }
+
+    // Shading from the material table, with static dispatch and emission skipped for the materials that do not emit,
+    // against virtual scatter, emitted and texture value calls on a polymorphic material per entry. The entries are
+    // those the scene interns into an empty table.
+    void materials() {
+        std::printf("%-20s %8s %10s %10s %10s %14s %14s %10s %10s\n", "scene", "entries", "KiB table", "ns(virt)",
+                    "ns(table)", "Mrays/s(virt)", "Mrays/s(table)", "mean(virt)", "mean(table)");
+        for (const auto which: {1, 5, 6, 7, 8}) {
+            const material_scope scope;
+            const auto s = select_scene(which);
+
+            material_table polymorphic;
+            for (material_id id = 0; id < scene_materials.size(); ++id)
+                if (polymorphic.intern(opaque(scene_materials[id])) != id)
+                    std::printf("ERROR: material %u does not keep its id.\n", id);
+
+            // The first hits of the camera rays, to time shading on its own.
+            std::vector<ray> rays;
+            std::vector<hit_record> recs;
+            for_each_camera_ray(s, 128, 1, [&](const ray &r, rng &gen) {
+                hit_record rec;
+                if (s.world.hit(r, ray_t_min, infinity, rec, gen)) {
+                    rays.emplace_back(r);
+                    recs.emplace_back(rec);
+                }
+            });
+
+            const path_limits limits;
+            std::array<double, 2> shade{infinity, infinity};
+            std::array<double, 2> rate{};
+            std::array<double, 2> mean{};
+            for (auto round = 0; round < 3; ++round)
+                for (auto k = 0; k < 2; ++k) {
+                    std::swap(scene_materials, polymorphic);
+
+                    rng gen{0};
+                    color sum{0, 0, 0};
+                    const auto shade_time = seconds([&] {
+                        for (auto pass = 0; pass < 16; ++pass)
+                            for (std::size_t i = 0; i < recs.size(); ++i) {
+                                auto &rec = recs[i];
+                                const auto &m = scene_materials[rec.mat];
+                                if (m.emits)
+                                    sum += m.emitted(rec.u, rec.v, rec.p);
+                                ray scattered;
+                                color attenuation;
+                                bounce_sample u{gen};
+                                if (m.scatter(rays[i], rec, u, attenuation, scattered, gen))
+                                    sum += attenuation + scattered.direction();
+                            }
+                    });
+                    if (sum.x() == infinity)
+                        std::printf("(overflow)\n");
+                    shade[k] = std::min(shade[k], shade_time / static_cast<double>(16 * recs.size()) * 1e9);
+                    path_stats stats;
+                    color total{0, 0, 0};
+                    const auto t = seconds([&] {
+                        for_each_camera_ray(s, 128, 8, [&](const ray &r, rng &gen) {
+                            total += trace_path(r, s.background, s.world, limits, gen, stats);
+                        });
+                    });
+                    rate[k] = std::max(rate[k], static_cast<double>(stats.rays) / t * 1e-6);
+                    mean[k] = luminance(total / static_cast<double>(stats.paths));
+                }
+
+            std::printf("%-20s %8zu %10.1f %10.2f %10.2f %14.3f %14.3f %10.4f %10.4f\n", s.name,
+                        scene_materials.size(),
+                        static_cast<double>(scene_materials.size() * sizeof(material_record)) / 1024,
+                        shade[0], shade[1], rate[0], rate[1], mean[0], mean[1]);
+        }
+    }
+
+    // The closed-form warps of sampling.h against the rejection loops of vec3.h that they replace: samples per second,
+    // and a moment of each distribution against its exact value. Cosine-weighted directions and cones are about varying
+    // normals, so that the onb is timed along with the warp.
+    void warps() {
+        constexpr std::size_t n = 1 << 22;
+        std::vector<vec3> normals;
+        rng normal_gen{1};
+        for (auto k = 0; k < 1024; ++k)
+            normals.emplace_back(uniform_sphere(random_2d(normal_gen)));
+        const auto normal = [&](std::size_t k) -> const vec3& { return normals[k & 1023]; };
+
+        std::printf("%-8s %16s %12s %8s %12s %12s %8s\n", "warp", "Msamples/s(old)", "Msamples/s", "speedup",
+                    "moment(old)", "moment", "exact");
+        const auto run = [&](const char *name, const auto &old_sample, const auto &new_sample, const auto &moment,
+                             double exact) {
+            std::array<double, 2> rate{};
+            std::array<double, 2> mean{};
+            const auto measure = [&](const auto &sample, std::size_t k) {
+                for (auto round = 0; round < 3; ++round) {
+                    rng gen{0};
+                    vec3 sum{0, 0, 0};
+                    const auto t = seconds([&] {
+                        for (std::size_t i = 0; i < n; ++i)
+                            sum += sample(i, gen);
+                    });
+                    if (sum.x() == infinity)
+                        std::printf("(overflow)\n");
+                    rate[k] = std::max(rate[k], static_cast<double>(n) / t * 1e-6);
+                }
+                rng gen{1};
+                for (std::size_t i = 0; i < n / 16; ++i)
+                    mean[k] += moment(i, sample(i, gen)) / static_cast<double>(n / 16);
+            };
+            measure(old_sample, 0);
+            measure(new_sample, 1);
+            std::printf("%-8s %16.2f %12.2f %7.2fx %12.4f %12.4f %8.4f\n", name, rate[0], rate[1], rate[1] / rate[0],
+                        mean[0], mean[1], exact);
+        };
+
+        const auto length_squared = [](std::size_t, const vec3 &p) { return static_cast<double>(p.length_squared()); };
+        const auto cosine = [&](std::size_t k, const vec3 &p) {
+            return static_cast<double>(normal(k).dot(p.unit_vector()));
+        };
+        run("disk",
+            [](std::size_t, rng &gen) { return random_in_unit_disk(gen); },
+            [](std::size_t, rng &gen) { return concentric_disk(random_2d(gen)); },
+            length_squared, 1.0 / 2);
+        run("ball",
+            [](std::size_t, rng &gen) { return random_in_unit_sphere(gen); },
+            [](std::size_t, rng &gen) { return uniform_ball(random_3d(gen)); },
+            length_squared, 3.0 / 5);
+        run("sphere",
+            [](std::size_t, rng &gen) { return random_unit_vector(gen); },
+            [](std::size_t, rng &gen) { return uniform_sphere(random_2d(gen)); },
+            [](std::size_t, const vec3 &p) { return static_cast<double>(p.z() * p.z()); }, 1.0 / 3);
+        run("cosine",
+            [&](std::size_t k, rng &gen) { return normal(k) + random_unit_vector(gen); },
+            [&](std::size_t k, rng &gen) { return onb::from_unit(normal(k)).local(cosine_hemisphere(random_2d(gen))); },
+            cosine, 2.0 / 3);
+
+        // The old cone is as sphere::random drew it, with the onb of before Duff et al.
+        const auto cos_theta_max = 0.9;
+        run("cone",
+            [&](std::size_t k, rng &gen) {
+                const auto r1 = random_double(gen);
+                const auto r2 = random_double(gen);
+                const auto z = 1 + r2 * (cos_theta_max - 1);
+                const auto phi = 2 * pi * r1;
+                const auto sin_theta = std::sqrt(1 - z * z);
+                const auto w = normal(k).unit_vector();
+                const auto a = std::fabs(w.x()) > 0.9 ? vec3{0, 1, 0} : vec3{1, 0, 0};
+                const auto v = w.cross(a).unit_vector();
+                return std::cos(phi) * sin_theta * w.cross(v) + std::sin(phi) * sin_theta * v + z * w;
+            },
+            [&](std::size_t k, rng &gen) {
+                return onb::from_unit(normal(k)).local(uniform_cone(random_2d(gen), cos_theta_max));
+            },
+            cosine, (1 + cos_theta_max) / 2);
+    }
+
+    // The error of each sampler against a reference rendered with many independent samples, at equal samples per
+    // pixel, on every built-in scene with next-event estimation, and the samples that independent sampling needs for
+    // the same error, taking its error to fall with the square root of the samples. The time is that of the sampler
+    // at the larger number of samples.
+    void samplers() {
+        constexpr auto width = 48;
+        constexpr auto reference_spp = 4096;
+        std::printf("%-20s %5s", "scene", "spp");
+        for (const auto name: sampler_names)
+            std::printf(" %12s", name);
+        std::printf("   spp ratio (stratified, halton, sobol)\n");
+
+        for (auto which = 1; which < static_cast<int>(scene_names.size()); ++which) {
+            const material_scope scope;
+            const auto s = select_scene(which);
+            const auto lights = s.lights.empty() ? nullptr : &s.lights;
+            const auto reference = render(s, width, reference_spp, 1, lights);
+
+            std::array<double, 4> time{};
+            for (const auto spp: {16, 64}) {
+                std::array<double, 4> error{};
+                for (std::size_t k = 0; k < sampler_names.size(); ++k) {
+                    std::vector<color> image;
+                    time[k] = seconds([&] {
+                        image = render(s, width, spp, 0, lights, true, static_cast<sampler_kind>(k));
+                    });
+                    error[k] = rmse(image, reference);
+                }
+                std::printf("%-20s %5d", s.name, spp);
+                for (const auto e: error)
+                    std::printf(" %12.4f", e);
+                std::printf("   ");
+                for (std::size_t k = 1; k < error.size(); ++k)
+                    std::printf(" %6.2fx", (error[0] * error[0]) / (error[k] * error[k]));
+                std::printf("\n");
+            }
+            std::printf("%-20s %5s", s.name, "s");
+            for (const auto t: time)
+                std::printf(" %12.3f", t);
+            std::printf("\n");
+        }
+    }
+
+    struct benchmark final {
+        const char *name;
+        std::function<void()> run;
+    };
+
+    const std::vector<benchmark> benchmarks{
+            {"path_length", path_length},
+            {"wavefront", wavefront},
+            {"packets", packets},
+            {"linear", linear},
+            {"sah", sah},
+            {"build", build},
+            {"bvh_stats", bvh_stats},
+            {"wide", wide},
+            {"handles", handles},
+            {"spheres", spheres},
+            {"motion", motion},
+            {"precision", precision},
+            {"vec3", vec3_ops},
+            {"by_value", by_value},
+            {"materials", materials},
+            {"occlusion", occlusion},
+            {"next_event", next_event},
+            {"mis", mis},
+            {"warps", warps},
+            {"samplers", samplers},
+    };
+}
+
+int main(int argc, char **argv) {
+    for (const auto &b: benchmarks) {
+        auto selected = argc == 1;
+        for (auto i = 1; i < argc; ++i)
+            selected = selected || std::strcmp(argv[i], b.name) == 0;
+        if (!selected)
+            continue;
+
+        // The scenes of each benchmark are released, with their materials, when it is done.
+        const material_scope scope;
+        std::printf("== %s\n", b.name);
+        b.run();
+        std::printf("\n");
+    }
+}
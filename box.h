@@ -16,7 +16,7 @@ public:
     hittable_list sides;
 
     box() noexcept = default;
-    box(const point3 &p0, const point3 &p1, shared_ptr<material> ptr) {
+    box(const point3 &p0, const point3 &p1, material_ref ptr) {
         box_min = p0;
         box_max = p1;
 
@@ -35,7 +35,11 @@ public:
         return true;
     }
 
-    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const noexcept override {
-        return sides.hit(r, t_min, t_max, rec);
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
+        return sides.hit(r, t_min, t_max, rec, gen);
+    }
+
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        return sides.occluded(r, t_min, t_max, gen);
     }
 };
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 
 #include "rtweekend.h"
@@ -43,6 +44,9 @@ public:
     std::shared_ptr<hittable> right;
     aabb box;
 
+    // The axis the children were sorted along: left is the lower of the two.
+    int axis = 0;
+
     bvh_node() noexcept = default;
 
     explicit bvh_node(const hittable_list &list) noexcept
@@ -59,13 +63,13 @@ public:
         // Create a modifiable array of the source scene objects.
         auto objects = src_objects;
 
-        int axis = random_int(0, 2);
+        axis = random_int(0, 2);
         const auto comparator =
-                [axis](const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
+                [axis = axis, time0, time1](const std::shared_ptr<hittable> a, const std::shared_ptr<hittable> b) {
                     aabb box_a;
                     aabb box_b;
 
-                    if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b))
+                    if (!a->bounding_box(time0, time1, box_a) || !b->bounding_box(time0, time1, box_b))
                         std::cerr << "No bounding box in bvh_node constructor.\n";
 
                     return box_a.minimum[axis] < box_b.minimum[axis];
@@ -101,13 +105,35 @@ public:
         return true;
     }
 
-    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const noexcept override {
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
         if (!box.hit(r, t_min, t_max))
             return false;
 
         // Call like this to get appropriate hit record.
-        bool hit_left = left->hit(r, t_min, t_max, rec);
-        bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+        bool hit_left = left->hit(r, t_min, t_max, rec, gen);
+        bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec, gen);
         return hit_left || hit_right;
     }
+
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        return box.hit(r, t_min, t_max)
+               && (left->occluded(r, t_min, t_max, gen) || (right != left && right->occluded(r, t_min, t_max, gen)));
+    }
+
+    [[nodiscard]] std::uint32_t hit_packet(ray_packet &packet,
+                                           std::uint32_t active,
+                                           double t_min) const noexcept override {
+        active = packet.hit_box(box, active, t_min);
+        if (!active)
+            return 0;
+
+        // Once too few rays are left to fill the SIMD lanes, finish this subtree one ray at a time.
+        if (!ray_packet::coherent(active))
+            return hittable::hit_packet(packet, active, t_min);
+
+        // Lanes that hit on the left have already lowered their t_max, as in hit.
+        const auto hit_left = left->hit_packet(packet, active, t_min);
+        const auto hit_right = right->hit_packet(packet, active, t_min);
+        return hit_left | hit_right;
+    }
 };
@@ -0,0 +1,440 @@
+/**
+ * bvh_builder.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+
+// How a BVH chooses its splits: bvh_node's median split along a random axis, binned SAH, or the bits of the Morton
+// codes of the primitives (an LBVH: much faster to build, but the tree is only approximate).
+enum class bvh_split {
+    median,
+    sah,
+    morton,
+};
+
+struct bvh_build_options final {
+    // Nodes with at most this many primitives become leaves when splitting them would not pay off. At most 65535.
+    int max_leaf_size = 4;
+
+    // The number of buckets the centroids are binned into along each axis.
+    int bins = 16;
+
+    // The cost of visiting a node, relative to intersecting a primitive.
+    double traversal_cost = 1.0;
+
+    // The number of threads to build with, or 0 for one per hardware thread. The tree does not depend on it.
+    unsigned threads = 0;
+};
+
+// Calls fn(begin, end) on consecutive chunks of [0, n), one chunk per thread.
+template<typename F>
+void parallel_chunks(std::size_t n, unsigned threads, F &&fn) {
+    const auto chunk = (n + threads - 1) / threads;
+    std::vector<std::jthread> workers;
+    for (auto begin = chunk; begin < n; begin += chunk)
+        workers.emplace_back([&fn, begin, end = std::min(n, begin + chunk)] { fn(begin, end); });
+    fn(std::size_t{0}, std::min(n, chunk));
+}
+
+// The parts shared by the top-down builders: the primitive bounds and centroids, computed once, and the index array
+// whose ranges the nodes cover. Each builder emits its nodes depth-first into an array. Large subtrees are built in
+// parallel into arrays of their own, which are appended in order, so the tree is the same for any number of threads.
+class bvh_builder {
+protected:
+    using node = linear_bvh::node;
+
+    const std::vector<std::shared_ptr<hittable>> &objects;
+    const bvh_build_options options;
+    const unsigned threads;
+
+    std::vector<aabb> bounds;
+    std::vector<point3> centroids;
+    std::vector<std::uint32_t> indices;
+
+    // Subtrees smaller than this are not worth a thread of their own.
+    static constexpr std::uint32_t min_parallel = 4096;
+
+    [[nodiscard]] static aabb empty_box() noexcept {
+        return aabb{point3{infinity, infinity, infinity}, point3{-infinity, -infinity, -infinity}};
+    }
+
+    [[nodiscard]] aabb range_box(std::uint32_t begin, std::uint32_t end) const noexcept {
+        auto box = empty_box();
+        for (auto k = begin; k < end; ++k)
+            box = surrounding_box(box, bounds[indices[k]]);
+        return box;
+    }
+
+    static void make_leaf(std::vector<node> &out, std::size_t index, std::uint32_t begin, std::uint32_t end) {
+        out[index].offset = begin;
+        out[index].count = static_cast<std::uint16_t>(end - begin);
+    }
+
+    // Build the children of out[index], over [begin, mid) and [mid, end), with build(begin, end, depth, out).
+    template<typename Build>
+    void build_children(std::vector<node> &out,
+                        std::size_t index,
+                        std::uint32_t begin,
+                        std::uint32_t mid,
+                        std::uint32_t end,
+                        int axis,
+                        int depth,
+                        Build &&build) {
+        out[index].axis = static_cast<std::uint8_t>(axis);
+
+        // Fork until every thread has a few subtrees to balance the load.
+        if (depth >= static_cast<int>(std::bit_width(threads)) + 2 || end - begin < min_parallel) {
+            build(begin, mid, depth + 1, out);
+            out[index].offset = static_cast<std::uint32_t>(out.size());
+            build(mid, end, depth + 1, out);
+            return;
+        }
+
+        std::vector<node> left, right;
+        auto forked = std::async(std::launch::async, [&] { build(begin, mid, depth + 1, left); });
+        build(mid, end, depth + 1, right);
+        forked.get();
+
+        append(out, left);
+        out[index].offset = static_cast<std::uint32_t>(out.size());
+        append(out, right);
+    }
+
+    static void append(std::vector<node> &out, const std::vector<node> &subtree) {
+        const auto base = static_cast<std::uint32_t>(out.size());
+        for (auto n: subtree) {
+            if (n.count == 0)
+                n.offset += base;
+            out.emplace_back(n);
+        }
+    }
+
+    // The leaves cover consecutive ranges of the index array, so it is also the order of the primitives.
+    [[nodiscard]] std::shared_ptr<linear_bvh> finish(std::vector<node> nodes) const {
+        std::vector<std::shared_ptr<hittable>> primitives;
+        primitives.reserve(indices.size());
+        for (const auto k: indices)
+            primitives.emplace_back(objects[k]);
+        nodes.shrink_to_fit();
+        return make_shared<linear_bvh>(std::move(nodes), std::move(primitives));
+    }
+
+public:
+    bvh_builder(const std::vector<std::shared_ptr<hittable>> &objects,
+                double time0,
+                double time1,
+                const bvh_build_options &options)
+    : objects{objects}, options{options},
+      threads{std::max(1u, options.threads ? options.threads : std::thread::hardware_concurrency())} {
+        bounds.resize(objects.size());
+        centroids.resize(objects.size());
+        indices.resize(objects.size());
+        parallel_chunks(objects.size(), threads, [&](std::size_t begin, std::size_t end) {
+            for (auto k = begin; k < end; ++k) {
+                if (!objects[k]->bounding_box(time0, time1, bounds[k]))
+                    std::cerr << "No bounding box in bvh_builder constructor.\n";
+                centroids[k] = 0.5 * (bounds[k].minimum + bounds[k].maximum);
+                indices[k] = static_cast<std::uint32_t>(k);
+            }
+        });
+    }
+
+    virtual ~bvh_builder() noexcept = default;
+
+    [[nodiscard]] virtual std::shared_ptr<linear_bvh> build() = 0;
+};
+
+// Builds a linear_bvh top-down with the surface area heuristic. Each node partitions its range of the index array in
+// place, so the primitives are never copied or queried again. Candidate splits are the boundaries between
+// equal-width bins of the centroids along each axis, and a node is split where the estimated cost of its children,
+// weighted by the chance of a ray that hits the node also hitting each child, is least.
+class sah_builder final : public bvh_builder {
+private:
+    struct bin final {
+        aabb box = empty_box();
+        std::uint32_t count = 0;
+    };
+
+    // Past this depth, nodes are split at their middle index, which bounds the rest of the tree by the depth of a
+    // balanced tree over 2^32 primitives.
+    static constexpr int max_sah_depth = linear_bvh::max_depth - 33;
+
+    void build(std::uint32_t begin, std::uint32_t end, int depth, std::vector<node> &out) {
+        const auto index = out.size();
+        out.emplace_back();
+
+        auto box = empty_box();
+        auto centroid_box = empty_box();
+        for (auto k = begin; k < end; ++k) {
+            box = surrounding_box(box, bounds[indices[k]]);
+            centroid_box = surrounding_box(centroid_box, aabb{centroids[indices[k]], centroids[indices[k]]});
+        }
+        out[index].box = box;
+
+        const auto count = end - begin;
+        if (count == 1) {
+            make_leaf(out, index, begin, end);
+            return;
+        }
+
+        // Scratch space for binning one axis of one node.
+        const auto bins = options.bins;
+        thread_local std::vector<bin> binned;
+        thread_local std::vector<double> right_area;
+        thread_local std::vector<std::uint32_t> right_count;
+        binned.resize(bins);
+        right_area.resize(bins);
+        right_count.resize(bins);
+
+        // Find the cheapest bin boundary over all three axes.
+        auto best_cost = infinity;
+        auto best_axis = -1;
+        auto best_split = 0;
+        if (depth < max_sah_depth) {
+            for (auto axis = 0; axis < 3; ++axis) {
+                const auto lo = centroid_box.minimum[axis];
+                const auto extent = centroid_box.maximum[axis] - lo;
+                if (extent <= 0)
+                    continue;
+
+                std::fill(binned.begin(), binned.end(), bin{});
+                for (auto k = begin; k < end; ++k) {
+                    auto &b = binned[bin_of(centroids[indices[k]][axis], lo, extent)];
+                    b.box = surrounding_box(b.box, bounds[indices[k]]);
+                    ++b.count;
+                }
+
+                // Sweep from the right for the children right of each boundary, then from the left to price them.
+                auto acc = empty_box();
+                std::uint32_t n = 0;
+                for (auto b = bins - 1; b > 0; --b) {
+                    acc = surrounding_box(acc, binned[b].box);
+                    n += binned[b].count;
+                    right_area[b] = n > 0 ? acc.surface_area() : 0.0;
+                    right_count[b] = n;
+                }
+
+                acc = empty_box();
+                n = 0;
+                for (auto b = 1; b < bins; ++b) {
+                    acc = surrounding_box(acc, binned[b - 1].box);
+                    n += binned[b - 1].count;
+                    if (n == 0 || right_count[b] == 0)
+                        continue;
+                    const auto cost = acc.surface_area() * n + right_area[b] * right_count[b];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_split = b;
+                    }
+                }
+            }
+        }
+
+        const auto recurse = [this](std::uint32_t b, std::uint32_t e, int d, std::vector<node> &o) { build(b, e, d, o); };
+
+        if (best_axis >= 0) {
+            // Only split when the children are cheaper than intersecting every primitive here.
+            const auto area = box.surface_area();
+            const auto split_cost = options.traversal_cost + (area > 0 ? best_cost / area : count);
+            if (count <= static_cast<std::uint32_t>(options.max_leaf_size) && split_cost >= count) {
+                make_leaf(out, index, begin, end);
+                return;
+            }
+
+            const auto lo = centroid_box.minimum[best_axis];
+            const auto extent = centroid_box.maximum[best_axis] - lo;
+            const auto mid_it = std::partition(indices.begin() + begin, indices.begin() + end,
+                                               [&](std::uint32_t k) {
+                                                   return bin_of(centroids[k][best_axis], lo, extent) < best_split;
+                                               });
+            const auto mid = static_cast<std::uint32_t>(mid_it - indices.begin());
+            build_children(out, index, begin, mid, end, best_axis, depth, recurse);
+            return;
+        }
+
+        // The centroids coincide, or the tree is too deep for SAH: split in the middle if the leaf would be too big.
+        if (count <= static_cast<std::uint32_t>(options.max_leaf_size)) {
+            make_leaf(out, index, begin, end);
+            return;
+        }
+        build_children(out, index, begin, begin + count / 2, end, 0, depth, recurse);
+    }
+
+    [[nodiscard]] int bin_of(double c, double lo, double extent) const noexcept {
+        return std::min(options.bins - 1, static_cast<int>(options.bins * ((c - lo) / extent)));
+    }
+
+public:
+    sah_builder(const std::vector<std::shared_ptr<hittable>> &objects,
+                double time0,
+                double time1,
+                const bvh_build_options &options = {})
+    : bvh_builder{objects, time0, time1, options} {}
+
+    [[nodiscard]] std::shared_ptr<linear_bvh> build() override {
+        std::vector<node> nodes;
+        nodes.reserve(2 * objects.size());
+        build(0, static_cast<std::uint32_t>(objects.size()), 0, nodes);
+        return finish(std::move(nodes));
+    }
+};
+
+// Builds an LBVH: the centroids are quantized to a 1024^3 grid and sorted along the Morton (Z-order) curve through it
+// with a parallel radix sort, and each node is split where the highest bit of the codes in its range changes. That
+// bit halves the node's cell of the grid along one axis, so building takes no heuristic at all.
+class morton_builder final : public bvh_builder {
+private:
+    std::vector<std::uint32_t> codes;
+
+    // Spread the low 10 bits of v out to every third bit.
+    [[nodiscard]] static std::uint32_t expand_bits(std::uint32_t v) noexcept {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
+    }
+
+    // A stable LSD radix sort of the indices by their codes, 8 bits a pass. Each thread counts the digits of its chunk,
+    // and then scatters it to the offsets of its digits after those of all earlier chunks.
+    void sort() {
+        const auto n = indices.size();
+        if (n == 0)
+            return;
+        std::vector<std::uint32_t> keys(n), scratch_keys(n), scratch_indices(n);
+        for (std::size_t k = 0; k < n; ++k)
+            keys[k] = codes[indices[k]];
+
+        const auto chunk = (n + threads - 1) / threads;
+        const auto chunks = chunk > 0 ? (n + chunk - 1) / chunk : 0;
+        std::vector<std::array<std::size_t, 256>> offsets(chunks);
+
+        for (auto shift = 0; shift < 32; shift += 8) {
+            const auto digit = [shift](std::uint32_t key) { return (key >> shift) & 0xFF; };
+
+            parallel_chunks(n, threads, [&](std::size_t begin, std::size_t end) {
+                auto &count = offsets[begin / chunk];
+                count.fill(0);
+                for (auto k = begin; k < end; ++k)
+                    ++count[digit(keys[k])];
+            });
+
+            std::size_t sum = 0;
+            for (auto d = 0; d < 256; ++d)
+                for (auto &count: offsets) {
+                    const auto c = count[d];
+                    count[d] = sum;
+                    sum += c;
+                }
+
+            parallel_chunks(n, threads, [&](std::size_t begin, std::size_t end) {
+                auto &offset = offsets[begin / chunk];
+                for (auto k = begin; k < end; ++k) {
+                    const auto to = offset[digit(keys[k])]++;
+                    scratch_keys[to] = keys[k];
+                    scratch_indices[to] = indices[k];
+                }
+            });
+            std::swap(keys, scratch_keys);
+            std::swap(indices, scratch_indices);
+        }
+
+        codes = std::move(keys);
+    }
+
+    void build(std::uint32_t begin, std::uint32_t end, int depth, std::vector<node> &out) {
+        const auto index = out.size();
+        out.emplace_back();
+
+        const auto count = end - begin;
+        if (count <= static_cast<std::uint32_t>(options.max_leaf_size)) {
+            out[index].box = range_box(begin, end);
+            make_leaf(out, index, begin, end);
+            return;
+        }
+
+        // The codes share every bit above the highest one that differs between the first and last, so the range
+        // splits where that bit turns on. Identical codes are split in the middle.
+        auto mid = begin + count / 2;
+        auto axis = 0;
+        const auto first = codes[begin];
+        const auto last = codes[end - 1];
+        if (first != last) {
+            const auto bit = std::bit_width(first ^ last) - 1;
+            mid = static_cast<std::uint32_t>(
+                    std::partition_point(codes.begin() + begin, codes.begin() + end,
+                                         [bit](std::uint32_t c) { return !(c & (1u << bit)); }) - codes.begin());
+            axis = 2 - bit % 3;
+        }
+
+        build_children(out, index, begin, mid, end, axis, depth,
+                       [this](std::uint32_t b, std::uint32_t e, int d, std::vector<node> &o) { build(b, e, d, o); });
+        out[index].box = surrounding_box(out[index + 1].box, out[out[index].offset].box);
+    }
+
+public:
+    morton_builder(const std::vector<std::shared_ptr<hittable>> &objects,
+                   double time0,
+                   double time1,
+                   const bvh_build_options &options = {})
+    : bvh_builder{objects, time0, time1, options} {}
+
+    [[nodiscard]] std::shared_ptr<linear_bvh> build() override {
+        // Quantize the centroids within their bounds. x takes the highest bit of each triple, then y, then z.
+        auto centroid_box = empty_box();
+        for (const auto &c: centroids)
+            centroid_box = surrounding_box(centroid_box, aabb{c, c});
+        const auto extent = centroid_box.maximum - centroid_box.minimum;
+
+        codes.resize(objects.size());
+        parallel_chunks(objects.size(), threads, [&](std::size_t begin, std::size_t end) {
+            for (auto k = begin; k < end; ++k) {
+                std::uint32_t code = 0;
+                for (auto a = 0; a < 3; ++a) {
+                    const auto t = extent[a] > 0 ? (centroids[k][a] - centroid_box.minimum[a]) / extent[a] : 0.0;
+                    const auto cell = static_cast<std::uint32_t>(std::clamp(t * 1024, 0.0, 1023.0));
+                    code |= expand_bits(cell) << (2 - a);
+                }
+                codes[k] = code;
+            }
+        });
+        sort();
+
+        std::vector<node> nodes;
+        nodes.reserve(2 * objects.size());
+        build(0, static_cast<std::uint32_t>(objects.size()), 0, nodes);
+        return finish(std::move(nodes));
+    }
+};
+
+[[nodiscard]] std::shared_ptr<linear_bvh> build_bvh(const hittable_list &list,
+                                                    double time0,
+                                                    double time1,
+                                                    bvh_split split = bvh_split::sah,
+                                                    const bvh_build_options &options = {}) {
+    switch (split) {
+        case bvh_split::median:
+            return make_shared<linear_bvh>(list, time0, time1);
+        case bvh_split::morton:
+            return morton_builder{list.objects, time0, time1, options}.build();
+        default:
+            return sah_builder{list.objects, time0, time1, options}.build();
+    }
+}
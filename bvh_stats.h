@@ -0,0 +1,349 @@
+/**
+ * bvh_stats.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "motion_bvh.h"
+#include "primitive.h"
+#include "wide_bvh.h"
+
+// Measures of the quality of a BVH, gathered by walking its nodes.
+struct bvh_report final {
+    // linear, wide4, wide8, motion or value (see bvh_layout and bvh_settings).
+    const char *layout = "linear";
+    aabb bounds;
+    std::size_t nodes = 0;
+    std::size_t leaves = 0;
+    std::size_t primitives = 0;
+    std::size_t memory_bytes = 0;
+
+    // The expected cost of a ray through the tree under the surface area heuristic, in primitive intersections.
+    double sah_cost = 0.0;
+
+    // Histograms of the depths of the leaves and of the number of primitives in them.
+    std::vector<std::uint64_t> leaf_depths;
+    std::vector<std::uint64_t> leaf_sizes;
+
+    // The surface area of the overlap of the two children of each interior node, relative to the area of the node.
+    double mean_sibling_overlap = 0.0;
+    double max_sibling_overlap = 0.0;
+
+    // The surface area of the largest primitive's box relative to the root's. Near 1, one primitive spans the whole
+    // tree and every ray has to test it.
+    double largest_primitive = 0.0;
+
+    // Traversal work for a sample of rays, if any were traced.
+    linear_bvh::traversal_stats traversal;
+};
+
+// The surface area of the intersection of two boxes, or 0 if they do not meet.
+[[nodiscard]] inline double overlap_area(const aabb &a, const aabb &b) noexcept {
+    const point3 lo{std::fmax(a.minimum.x(), b.minimum.x()),
+                    std::fmax(a.minimum.y(), b.minimum.y()),
+                    std::fmax(a.minimum.z(), b.minimum.z())};
+    const point3 hi{std::fmin(a.maximum.x(), b.maximum.x()),
+                    std::fmin(a.maximum.y(), b.maximum.y()),
+                    std::fmin(a.maximum.z(), b.maximum.z())};
+    if (lo.x() <= hi.x() && lo.y() <= hi.y() && lo.z() <= hi.z())
+        return aabb{lo, hi}.surface_area();
+    return 0.0;
+}
+
+// Record a leaf at depth with count primitives and the relative area area into report.
+inline void add_leaf(bvh_report &report, int depth, std::size_t count, double area) {
+    ++report.leaves;
+    report.sah_cost += area * static_cast<double>(count);
+    report.leaf_depths.resize(std::max<std::size_t>(report.leaf_depths.size(), depth + 1));
+    ++report.leaf_depths[depth];
+    report.leaf_sizes.resize(std::max<std::size_t>(report.leaf_sizes.size(), count + 1));
+    ++report.leaf_sizes[count];
+}
+
+// The report on a tree of linear_bvh nodes, which linear_bvh, motion_bvh and primitive_bvh all keep. box_of(p, box)
+// gives the bounds of primitive p.
+template<typename BoxOf>
+[[nodiscard]] bvh_report analyze_nodes(const char *layout,
+                                       const std::vector<linear_bvh::node> &nodes,
+                                       std::size_t primitives,
+                                       std::size_t memory_bytes,
+                                       BoxOf &&box_of,
+                                       double traversal_cost) {
+    bvh_report report;
+    report.layout = layout;
+    report.bounds = nodes.front().box;
+    report.nodes = nodes.size();
+    report.primitives = primitives;
+    report.memory_bytes = memory_bytes;
+
+    const auto root_area = report.bounds.surface_area();
+    const auto relative_area = [root_area](const aabb &box) {
+        return root_area > 0 ? box.surface_area() / root_area : 1.0;
+    };
+
+    std::size_t interior = 0;
+    std::vector<std::pair<std::uint32_t, int>> stack{{0, 0}};
+    while (!stack.empty()) {
+        const auto [index, depth] = stack.back();
+        stack.pop_back();
+        const auto &n = nodes[index];
+
+        if (n.count > 0) {
+            add_leaf(report, depth, n.count, relative_area(n.box));
+            continue;
+        }
+
+        ++interior;
+        report.sah_cost += relative_area(n.box) * traversal_cost;
+
+        const auto overlap = n.box.surface_area() > 0
+                             ? overlap_area(nodes[index + 1].box, nodes[n.offset].box) / n.box.surface_area() : 0.0;
+        report.mean_sibling_overlap += overlap;
+        report.max_sibling_overlap = std::max(report.max_sibling_overlap, overlap);
+
+        stack.emplace_back(n.offset, depth + 1);
+        stack.emplace_back(index + 1, depth + 1);
+    }
+    if (interior > 0)
+        report.mean_sibling_overlap /= static_cast<double>(interior);
+
+    for (std::size_t p = 0; p < primitives; ++p) {
+        aabb box;
+        if (box_of(p, box))
+            report.largest_primitive = std::max(report.largest_primitive, relative_area(box));
+    }
+
+    return report;
+}
+
+[[nodiscard]] bvh_report analyze_bvh(const linear_bvh &bvh, double time0 = 0.0, double time1 = 1.0,
+                                     double traversal_cost = 1.0) {
+    const auto memory = sizeof(linear_bvh)
+                        + bvh.nodes.capacity() * sizeof(linear_bvh::node)
+                        + bvh.primitives.capacity() * sizeof(std::shared_ptr<hittable>);
+    return analyze_nodes("linear", bvh.nodes, bvh.primitives.size(), memory, [&](std::size_t p, aabb &box) {
+        return bvh.primitives[p]->bounding_box(time0, time1, box);
+    }, traversal_cost);
+}
+
+[[nodiscard]] bvh_report analyze_bvh(const motion_bvh &bvh, double traversal_cost = 1.0) {
+    const auto memory = sizeof(motion_bvh)
+                        + bvh.nodes.capacity() * sizeof(linear_bvh::node)
+                        + bvh.primitives.capacity() * sizeof(std::shared_ptr<hittable>)
+                        + bvh.segments.capacity() * sizeof(motion_bvh::segment);
+    return analyze_nodes("motion", bvh.nodes, bvh.primitives.size(), memory, [&](std::size_t p, aabb &box) {
+        return bvh.primitives[p]->bounding_box(bvh.time0, bvh.time1, box);
+    }, traversal_cost);
+}
+
+[[nodiscard]] bvh_report analyze_bvh(const primitive_bvh &bvh, double time0 = 0.0, double time1 = 1.0,
+                                     double traversal_cost = 1.0) {
+    const auto memory = sizeof(primitive_bvh)
+                        + bvh.nodes.capacity() * sizeof(linear_bvh::node)
+                        + bvh.primitives.capacity() * sizeof(primitive);
+    return analyze_nodes("value", bvh.nodes, bvh.primitives.size(), memory, [&](std::size_t p, aabb &box) {
+        return bounding_box(bvh.primitives[p], time0, time1, box);
+    }, traversal_cost);
+}
+
+// The report on a wide BVH. Its leaves are the leaf slots of its nodes, and the sibling overlap of a node is the summed
+// overlap of each pair of its children, which for two children is that of a binary node.
+template<int Width>
+[[nodiscard]] bvh_report analyze_bvh(const wide_bvh<Width> &bvh, double time0 = 0.0, double time1 = 1.0,
+                                     double traversal_cost = 1.0) {
+    using node = typename wide_bvh<Width>::node;
+    bvh_report report;
+    report.layout = Width == 4 ? "wide4" : "wide8";
+    (void) bvh.bounding_box(time0, time1, report.bounds);
+    report.nodes = bvh.nodes.size();
+    report.primitives = bvh.primitives.size();
+    report.memory_bytes = sizeof(wide_bvh<Width>)
+                          + bvh.nodes.capacity() * sizeof(node)
+                          + bvh.primitives.capacity() * sizeof(std::shared_ptr<hittable>);
+
+    const auto root_area = report.bounds.surface_area();
+    const auto relative_area = [root_area](const aabb &box) {
+        return root_area > 0 ? box.surface_area() / root_area : 1.0;
+    };
+
+    std::vector<std::pair<std::uint32_t, int>> stack{{0, 0}};
+    while (!stack.empty()) {
+        const auto [index, depth] = stack.back();
+        stack.pop_back();
+        const auto &n = bvh.nodes[index];
+
+        // The used slots hold non-empty boxes.
+        std::vector<aabb> children;
+        aabb bounds{point3{infinity, infinity, infinity}, point3{-infinity, -infinity, -infinity}};
+        for (auto k = 0; k < Width; ++k) {
+            if (n.minimum[0][k] > n.maximum[0][k])
+                continue;
+            children.emplace_back(point3{n.minimum[0][k], n.minimum[1][k], n.minimum[2][k]},
+                                  point3{n.maximum[0][k], n.maximum[1][k], n.maximum[2][k]});
+            bounds = surrounding_box(bounds, children.back());
+            if (n.count[k] > 0)
+                add_leaf(report, depth + 1, n.count[k], relative_area(children.back()));
+            else
+                stack.emplace_back(n.offset[k], depth + 1);
+        }
+        report.sah_cost += relative_area(bounds) * traversal_cost;
+
+        auto overlap = 0.0;
+        for (std::size_t a = 0; a < children.size(); ++a)
+            for (auto b = a + 1; b < children.size(); ++b)
+                overlap += overlap_area(children[a], children[b]);
+        if (bounds.surface_area() > 0)
+            overlap /= bounds.surface_area();
+        report.mean_sibling_overlap += overlap;
+        report.max_sibling_overlap = std::max(report.max_sibling_overlap, overlap);
+    }
+    if (!bvh.nodes.empty())
+        report.mean_sibling_overlap /= static_cast<double>(bvh.nodes.size());
+
+    for (const auto &p: bvh.primitives) {
+        aabb box;
+        if (p->bounding_box(time0, time1, box))
+            report.largest_primitive = std::max(report.largest_primitive, relative_area(box));
+    }
+
+    return report;
+}
+
+// A BVH of any of the layouts that the report covers. The tree of bvh_nodes is not covered.
+using any_bvh = std::variant<const linear_bvh*,
+                             const wide_bvh<4>*,
+                             const wide_bvh<8>*,
+                             const motion_bvh*,
+                             const primitive_bvh*>;
+
+// Every BVH reachable from object, outermost first.
+void find_bvhs(const hittable *object, std::vector<any_bvh> &bvhs) {
+    const auto nested = [&bvhs](const std::vector<std::shared_ptr<hittable>> &primitives) {
+        for (const auto &p: primitives)
+            find_bvhs(p.get(), bvhs);
+    };
+
+    if (const auto bvh = dynamic_cast<const linear_bvh*>(object)) {
+        bvhs.emplace_back(bvh);
+        nested(bvh->primitives);
+    } else if (const auto w4 = dynamic_cast<const wide_bvh<4>*>(object)) {
+        bvhs.emplace_back(w4);
+        nested(w4->primitives);
+    } else if (const auto w8 = dynamic_cast<const wide_bvh<8>*>(object)) {
+        bvhs.emplace_back(w8);
+        nested(w8->primitives);
+    } else if (const auto m = dynamic_cast<const motion_bvh*>(object)) {
+        bvhs.emplace_back(m);
+        nested(m->primitives);
+    } else if (const auto v = dynamic_cast<const primitive_bvh*>(object)) {
+        bvhs.emplace_back(v);
+        for (const auto &p: v->primitives) {
+            if (const auto o = std::get_if<std::shared_ptr<hittable>>(&p))
+                find_bvhs(o->get(), bvhs);
+            else if (const auto t = std::get_if<translate>(&p))
+                find_bvhs(t->ptr.get(), bvhs);
+            else if (const auto r = std::get_if<rotate_y>(&p))
+                find_bvhs(r->ptr.get(), bvhs);
+        }
+    } else if (const auto list = dynamic_cast<const hittable_list*>(object)) {
+        for (const auto &o: list->objects)
+            find_bvhs(o.get(), bvhs);
+    } else if (const auto t = dynamic_cast<const translate*>(object)) {
+        find_bvhs(t->ptr.get(), bvhs);
+    } else if (const auto r = dynamic_cast<const rotate_y*>(object)) {
+        find_bvhs(r->ptr.get(), bvhs);
+    }
+}
+
+void write_json(std::ostream &out, const bvh_report &report) {
+    const auto vec = [&out](const point3 &p) {
+        out << '[' << p.x() << ", " << p.y() << ", " << p.z() << ']';
+    };
+    const auto histogram = [&out](const std::vector<std::uint64_t> &h) {
+        out << '[';
+        for (std::size_t k = 0; k < h.size(); ++k)
+            out << (k ? ", " : "") << h[k];
+        out << ']';
+    };
+
+    out << "{\"layout\": \"" << report.layout << "\", \"bounds\": {\"min\": ";
+    vec(report.bounds.minimum);
+    out << ", \"max\": ";
+    vec(report.bounds.maximum);
+    out << "}, \"nodes\": " << report.nodes
+        << ", \"leaves\": " << report.leaves
+        << ", \"primitives\": " << report.primitives
+        << ", \"memory_bytes\": " << report.memory_bytes
+        << ", \"sah_cost\": " << report.sah_cost
+        << ", \"leaf_depths\": ";
+    histogram(report.leaf_depths);
+    out << ", \"leaf_sizes\": ";
+    histogram(report.leaf_sizes);
+    out << ", \"sibling_overlap\": {\"mean\": " << report.mean_sibling_overlap
+        << ", \"max\": " << report.max_sibling_overlap << '}'
+        << ", \"largest_primitive\": " << report.largest_primitive;
+
+    const auto &t = report.traversal;
+    if (t.rays > 0) {
+        const auto rays = static_cast<double>(t.rays);
+        out << ", \"traversal\": {\"rays\": " << t.rays
+            << ", \"node_visits_per_ray\": " << static_cast<double>(t.node_visits) / rays
+            << ", \"primitive_tests_per_ray\": " << static_cast<double>(t.primitive_tests) / rays << '}';
+    }
+    out << '}';
+}
+
+// Write a report on every BVH in world as a JSON object. The rays are traced through the outermost BVH, if the world
+// is one whose traversal is counted (linear or motion); the traversal counts of the nested BVHs are not gathered,
+// since they see the rays in their own space. Returns false, writing nothing, if the world has no BVH of a layout that
+// the report covers.
+bool write_bvh_report(std::ostream &out, const char *name, const hittable_list &world, const std::vector<ray> &rays) {
+    std::vector<any_bvh> bvhs;
+    find_bvhs(&world, bvhs);
+    if (bvhs.empty()) {
+        std::cerr << "ERROR: " << name << " has no BVH of a layout the report covers (linear, wide4, wide8, motion "
+                  << "or value).\n";
+        return false;
+    }
+
+    std::vector<bvh_report> reports;
+    for (const auto &bvh: bvhs)
+        reports.emplace_back(std::visit([](const auto *b) { return analyze_bvh(*b); }, bvh));
+
+    const auto outermost = std::visit([](const auto *b) { return static_cast<const hittable*>(b); }, bvhs.front());
+    if (world.objects.size() == 1 && world.objects.front().get() == outermost) {
+        rng gen{0};
+        hit_record rec;
+        std::visit([&](const auto *b) {
+            using type = std::decay_t<decltype(*b)>;
+            if constexpr (std::is_same_v<type, linear_bvh> || std::is_same_v<type, motion_bvh>)
+                for (const auto &r: rays)
+                    (void) b->hit(r, ray_t_min, infinity, rec, gen, reports.front().traversal);
+        }, bvhs.front());
+    }
+
+    out << "{\"scene\": \"" << name << "\", \"bvhs\": [";
+    for (std::size_t k = 0; k < reports.size(); ++k) {
+        out << (k ? ",\n  " : "\n  ");
+        write_json(out, reports[k]);
+    }
+    out << "\n]}";
+    return true;
+}
@@ -7,56 +7,66 @@
 
 #include "rtweekend.h"
 #include "ray.h"
+#include "sampling.h"
 #include "vec3.h"
 
-class camera final {
+// A camera whose rays are set up in T.
+template<typename T>
+class basic_camera final {
 public:
-    static const double focal_length;
+    static constexpr T focal_length = 1;
 
 private:
-    point3 origin;
-    point3 lower_left_corner;
-    vec3 horizontal;
-    vec3 vertical;
-    vec3 u, v, w;
-    double lens_radius;
+    basic_vec3<T> origin;
+    basic_vec3<T> lower_left_corner;
+    basic_vec3<T> horizontal;
+    basic_vec3<T> vertical;
+    basic_vec3<T> u, v, w;
+    T lens_radius;
     double time0;
     double time1;
 
 public:
-    camera(point3 lookfrom,
-           point3 lookat,
-           vec3 vup,
-           double vertical_fov,
-           double aspect_ratio,
-           double aperture,
-           double focus_dist,
-           double time0 = 0.0,
-           double time1 = 0.0) : time0{time0}, time1{time1} {
+    basic_camera(const point3 &lookfrom,
+                 const point3 &lookat,
+                 const vec3 &vup,
+                 double vertical_fov,
+                 double aspect_ratio,
+                 double aperture,
+                 double focus_dist,
+                 double time0 = 0.0,
+                 double time1 = 0.0) : time0{time0}, time1{time1} {
         const auto theta = degrees_to_radians(vertical_fov);
         const auto h = std::tan(theta / 2);
         const auto viewport_height = 2.0 * h;
         const auto viewport_width = aspect_ratio * viewport_height;
 
-        w = (lookfrom - lookat).unit_vector();
-        u = vup.cross(w).unit_vector();
+        w = basic_vec3<T>{lookfrom - lookat}.unit_vector();
+        u = basic_vec3<T>{vup}.cross(w).unit_vector();
         v = w.cross(u);
 
-        origin = lookfrom;
+        origin = basic_vec3<T>{lookfrom};
         horizontal = focus_dist * viewport_width * u;
         vertical = focus_dist * viewport_height * v;
         lower_left_corner = origin - horizontal / 2 - vertical / 2 - focus_dist * w;
 
-        lens_radius = aperture / 2;
+        lens_radius = static_cast<T>(aperture / 2);
     }
 
-    [[nodiscard]] ray get_ray(double s, double t) const noexcept {
-        const auto rd = lens_radius * random_in_unit_disk();
+    [[nodiscard]] basic_ray<T> get_ray(double s, double t, rng &gen) const noexcept {
+        const auto lens = random_2d(gen);
+        return get_ray(s, t, lens, random_double(gen));
+    }
+
+    // The ray through (s, t) from the point of the lens that the sample lens maps to, at the fraction time of the
+    // way through the shutter interval.
+    [[nodiscard]] basic_ray<T> get_ray(double s, double t, const sample_2d &lens, double time) const noexcept {
+        const auto rd = lens_radius * basic_vec3<T>{concentric_disk(lens)};
         const auto offset = u * rd.x() + v * rd.y();
         return {origin + offset,
                 lower_left_corner + s * horizontal + t * vertical - origin - offset,
-                random_double(time0, time1)};
+                time0 + (time1 - time0) * time};
     }
 };
 
-const double camera::focal_length = 1.0;
\ No newline at end of file
+using camera = basic_camera<real>;
@@ -0,0 +1,206 @@
+/**
+ * checkpoint.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pixel_stats.h"
+#include "sampler.h"
+#include "vec3.h"
+
+// A memory-mapped accumulation buffer for progressive rendering.
+//
+// The file holds a header and two slots, each with a float RGB sum, a sample count and the running luminance mean
+// and variance (see pixel_stats) per pixel. One slot is current; a pass writes its refined pixels into the other and
+// commit() flushes it and flips the header. A render killed at any point therefore leaves a consistent checkpoint
+// from the last completed pass.
+//
+// Sample streams are derived from (pixel, sample index, seed), and sample points from those and the sampler's kind and
+// round size (see sampler.h), none of which depends on the number of samples a pixel will take. The per-pixel counts,
+// the seed and the sampler are therefore the complete sampling state: resuming continues every pixel from exactly the
+// sample it would have drawn next. The header records the seed, the sampler and the identity of the scene (see
+// scene::identity), so that a checkpoint is only resumed by the render it was made by.
+class checkpoint final {
+private:
+    struct header final {
+        char magic[8];
+        std::uint32_t version;
+        std::int32_t width;
+        std::int32_t height;
+        std::uint32_t active;
+        std::uint64_t seed;
+        std::uint64_t scene;
+        std::uint32_t sampling;
+        std::uint32_t sampling_round;
+        std::uint64_t passes;
+        std::uint64_t samples;
+    };
+
+    static constexpr char file_magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+    static constexpr std::uint32_t file_version = 4;
+
+    int fd = -1;
+    void *mapping = MAP_FAILED;
+    std::size_t mapping_size = 0;
+    header *head = nullptr;
+    std::size_t pixel_count = 0;
+    bool was_resumed = false;
+
+    [[nodiscard]] std::size_t slot_size() const noexcept {
+        return pixel_count * (5 * sizeof(float) + sizeof(std::uint32_t));
+    }
+
+    [[nodiscard]] std::byte *slot(std::uint32_t index) const noexcept {
+        return static_cast<std::byte*>(mapping) + sizeof(header) + index * slot_size();
+    }
+
+    [[nodiscard]] float *sums(std::uint32_t index) const noexcept {
+        return reinterpret_cast<float*>(slot(index));
+    }
+
+    [[nodiscard]] std::uint32_t *counts(std::uint32_t index) const noexcept {
+        return reinterpret_cast<std::uint32_t*>(slot(index) + pixel_count * 3 * sizeof(float));
+    }
+
+    [[nodiscard]] float *means(std::uint32_t index) const noexcept {
+        return reinterpret_cast<float*>(slot(index) + pixel_count * (3 * sizeof(float) + sizeof(std::uint32_t)));
+    }
+
+    [[nodiscard]] float *m2s(std::uint32_t index) const noexcept {
+        return means(index) + pixel_count;
+    }
+
+    [[nodiscard]] std::size_t index(int i, int j) const noexcept {
+        return static_cast<std::size_t>(j) * head->width + i;
+    }
+
+public:
+    // Open the checkpoint at path, resuming it if it matches the frame size, seed, scene and sampler, and starting
+    // afresh otherwise.
+    checkpoint(const std::string &path,
+               int width,
+               int height,
+               std::uint64_t seed,
+               std::uint64_t scene,
+               const sampler &samples) noexcept {
+        pixel_count = static_cast<std::size_t>(width) * height;
+        mapping_size = sizeof(header) + 2 * slot_size();
+
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            std::cerr << "ERROR: Could not open checkpoint file: '" << path << "'\n";
+            return;
+        }
+
+        struct stat st{};
+        const auto existing = ::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) == mapping_size;
+        if (!existing && ::ftruncate(fd, static_cast<off_t>(mapping_size)) != 0) {
+            std::cerr << "ERROR: Could not size checkpoint file: '" << path << "'\n";
+            return;
+        }
+
+        mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "ERROR: Could not map checkpoint file: '" << path << "'\n";
+            return;
+        }
+        head = static_cast<header*>(mapping);
+
+        was_resumed = existing
+                      && std::memcmp(head->magic, file_magic, sizeof(file_magic)) == 0
+                      && head->version == file_version
+                      && head->width == width
+                      && head->height == height
+                      && head->seed == seed
+                      && head->scene == scene
+                      && head->sampling == static_cast<std::uint32_t>(samples.kind)
+                      && head->sampling_round == samples.samples_per_round
+                      && head->active < 2;
+        if (was_resumed)
+            return;
+        if (existing)
+            std::cerr << "Checkpoint file '" << path << "' is of another render; starting afresh.\n";
+
+        std::memset(mapping, 0, mapping_size);
+        std::memcpy(head->magic, file_magic, sizeof(file_magic));
+        head->version = file_version;
+        head->width = width;
+        head->height = height;
+        head->seed = seed;
+        head->scene = scene;
+        head->sampling = static_cast<std::uint32_t>(samples.kind);
+        head->sampling_round = samples.samples_per_round;
+        ::msync(mapping, mapping_size, MS_SYNC);
+    }
+
+    checkpoint(const checkpoint&) = delete;
+    checkpoint &operator=(const checkpoint&) = delete;
+
+    ~checkpoint() {
+        if (mapping != MAP_FAILED)
+            ::munmap(mapping, mapping_size);
+        if (fd >= 0)
+            ::close(fd);
+    }
+
+    [[nodiscard]] bool is_open() const noexcept { return head != nullptr; }
+    [[nodiscard]] bool resumed() const noexcept { return was_resumed; }
+
+    [[nodiscard]] auto width() const noexcept { return head->width; }
+    [[nodiscard]] auto height() const noexcept { return head->height; }
+    [[nodiscard]] auto seed() const noexcept { return head->seed; }
+    [[nodiscard]] auto passes() const noexcept { return head->passes; }
+
+    // The number of samples per pixel that every committed pass has reached.
+    [[nodiscard]] auto samples() const noexcept { return head->samples; }
+
+    [[nodiscard]] color sum(int i, int j) const noexcept {
+        const auto s = sums(head->active) + 3 * index(i, j);
+        return color{s[0], s[1], s[2]};
+    }
+
+    [[nodiscard]] std::uint32_t count(int i, int j) const noexcept {
+        return counts(head->active)[index(i, j)];
+    }
+
+    [[nodiscard]] pixel_stats stats(int i, int j) const noexcept {
+        const auto k = index(i, j);
+        return pixel_stats{counts(head->active)[k], means(head->active)[k], m2s(head->active)[k]};
+    }
+
+    // Record the refined value of a pixel for the pass in progress. Each pixel must be stored exactly once per pass.
+    void store(int i, int j, const color &pixel_sum, const pixel_stats &pixel) noexcept {
+        const auto next = 1 - head->active;
+        const auto k = index(i, j);
+        const auto s = sums(next) + 3 * k;
+        s[0] = static_cast<float>(pixel_sum.x());
+        s[1] = static_cast<float>(pixel_sum.y());
+        s[2] = static_cast<float>(pixel_sum.z());
+        counts(next)[k] = static_cast<std::uint32_t>(pixel.count);
+        means(next)[k] = static_cast<float>(pixel.mean);
+        m2s(next)[k] = static_cast<float>(pixel.m2);
+    }
+
+    // Flush the pass in progress to disk and make it current.
+    void commit(std::uint64_t samples_reached) noexcept {
+        const auto next = 1 - head->active;
+        ::msync(mapping, mapping_size, MS_SYNC);
+
+        head->active = next;
+        head->samples = samples_reached;
+        ++head->passes;
+        ::msync(mapping, sizeof(header), MS_SYNC);
+    }
+};
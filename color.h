@@ -6,25 +6,43 @@
 
 #include "vec3.h"
 
-#include <iostream>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 
-[[nodiscard]] auto color_int(double c) noexcept {
-    return static_cast<int>(256 * clamp(c, 0.0, 0.999));
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+[[nodiscard]] inline std::uint8_t color_byte(float c) noexcept {
+    // Gamma-correct for gamma = 2.0 and map to [0,255]. Negative and NaN values become black.
+    const auto g = c > 0.0f ? std::sqrt(c) : 0.0f;
+    return static_cast<std::uint8_t>(256.0f * std::fmin(g, 0.999f));
 }
 
-void write_color(std::ostream &out, const color &pixel_color, int samples_per_pixel) noexcept {
-    auto r = pixel_color.x();
-    auto g = pixel_color.y();
-    auto b = pixel_color.z();
-
-    // Divide the color by the number of samples and gamma-correct for gamma = 2.0.
-    const auto scale = 1.0 / samples_per_pixel;
-    r = sqrt(scale * r);
-    g = sqrt(scale * g);
-    b = sqrt(scale * b);
-
-    // Write the translated [0,255] value of each color component.
-    out << static_cast<int>(color_int(r)) << ' '
-        << static_cast<int>(color_int(g)) << ' '
-        << static_cast<int>(color_int(b)) << '\n';
+// Gamma-correct and quantize n linear color components to bytes in one pass over the buffer, 16 at a time with SSE2.
+void quantize(const float *in, std::uint8_t *out, std::size_t n) noexcept {
+    std::size_t k = 0;
+
+#ifdef __SSE2__
+    const auto zero = _mm_setzero_ps();
+    const auto top = _mm_set1_ps(0.999f);
+    const auto scale = _mm_set1_ps(256.0f);
+
+    for (; k + 16 <= n; k += 16) {
+        __m128i q[4];
+        for (auto l = 0; l < 4; ++l) {
+            // max returns its second operand when the first is NaN, so NaNs are flushed to black here too.
+            auto v = _mm_max_ps(_mm_loadu_ps(in + k + 4 * l), zero);
+            v = _mm_min_ps(_mm_sqrt_ps(v), top);
+            q[l] = _mm_cvttps_epi32(_mm_mul_ps(v, scale));
+        }
+        const auto lo = _mm_packs_epi32(q[0], q[1]);
+        const auto hi = _mm_packs_epi32(q[2], q[3]);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; k < n; ++k)
+        out[k] = color_byte(in[k]);
 }
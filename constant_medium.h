@@ -10,39 +10,40 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "material.h"
+#include "material_table.h"
 #include "texture.h"
 
 class constant_medium final : public hittable {
 public:
     shared_ptr<hittable> boundary;
-    shared_ptr<material> phase_function;
+    material_id phase_function;
     double neg_inv_density;
 
     constant_medium(shared_ptr<hittable> boundary,
                     double density,
-                    const shared_ptr<texture>& texture) noexcept
+                    const shared_ptr<texture>& texture)
                     : boundary{std::move(boundary)},
                       neg_inv_density{-1.0/density},
-                      phase_function{make_shared<isotropic>(texture)} {}
+                      phase_function{scene_materials.intern(make_shared<isotropic>(texture))} {}
 
     constant_medium(shared_ptr<hittable> boundary,
                     double density,
-                    color c) noexcept
+                    color c)
                     : boundary{std::move(boundary)},
                       neg_inv_density{-1.0/density},
-                      phase_function{make_shared<isotropic>(c)} {}
+                      phase_function{scene_materials.intern(material_record::isotropic(c))} {}
 
-    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const noexcept override {
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
         // Print occasional samples when debugging. Set enableDebug to true.
         constexpr bool enableDebug = false;
-        const bool debugging = enableDebug && random_double() < 1e-5;
+        const bool debugging = enableDebug && random_double(gen) < 1e-5;
 
         hit_record rec1;
-        if (!boundary->hit(r, -infinity, infinity, rec1))
+        if (!boundary->hit(r, -infinity, infinity, rec1, gen))
             return false;
 
         hit_record rec2;
-        if (!boundary->hit(r, rec1.t + 1e-4, infinity, rec2))
+        if (!boundary->hit(r, rec1.t + 1e-4, infinity, rec2, gen))
             return false;
 
         if (debugging)
@@ -58,7 +59,7 @@ public:
         const auto ray_length = r.direction().length();
         const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
 
-        const auto hit_distance = neg_inv_density * log(random_double());
+        const auto hit_distance = neg_inv_density * log(random_double(gen));
         if (hit_distance > distance_inside_boundary)
             return false;
 
@@ -73,7 +74,7 @@ public:
         // These values are arbitrary.
         rec.normal = vec3{1, 0, 0};
         rec.front_face = true;
-        rec.mat_ptr = phase_function;
+        rec.mat = phase_function;
 
         return true;
     };
@@ -0,0 +1,48 @@
+/**
+ * framebuffer.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "vec3.h"
+
+// A full-frame buffer of summed pixel colors and the number of samples in each sum.
+// Row 0 is the bottom scanline, matching the camera's v axis.
+// Every pixel belongs to exactly one tile, so workers can write into their own region without locking.
+class framebuffer final {
+private:
+    int w;
+    int h;
+    std::vector<color> pixels;
+    std::vector<std::uint32_t> counts;
+
+public:
+    framebuffer(int width, int height) noexcept
+    : w{width}, h{height},
+      pixels(static_cast<std::size_t>(width) * height),
+      counts(static_cast<std::size_t>(width) * height) {}
+
+    [[nodiscard]] auto width() const noexcept { return w; }
+    [[nodiscard]] auto height() const noexcept { return h; }
+
+    [[nodiscard]] const auto &operator()(int i, int j) const noexcept {
+        return pixels[static_cast<std::size_t>(j) * w + i];
+    }
+
+    [[nodiscard]] auto &operator()(int i, int j) noexcept {
+        return pixels[static_cast<std::size_t>(j) * w + i];
+    }
+
+    [[nodiscard]] auto samples(int i, int j) const noexcept {
+        return counts[static_cast<std::size_t>(j) * w + i];
+    }
+
+    [[nodiscard]] auto &samples(int i, int j) noexcept {
+        return counts[static_cast<std::size_t>(j) * w + i];
+    }
+};
@@ -4,22 +4,28 @@
  */
 #pragma once
 
+#include <bit>
+#include <cstdint>
 #include <utility>
 
 #include "aabb.h"
+#include "packet.h"
 #include "ray.h"
 
-class material;
+// An index into the material table (see material_table.h).
+using material_id = std::uint32_t;
 
 struct hit_record final {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
-    double t;
+    // An index rather than a shared_ptr, which keeps the record trivially copyable, so traversal does no reference
+    // counting.
+    material_id mat = 0;
+    real t;
 
     // Coordinates for texture.
-    double u;
-    double v;
+    real u;
+    real v;
 
     bool front_face;
 
@@ -31,8 +37,44 @@ struct hit_record final {
 
 class hittable {
 public:
-    [[nodiscard]] virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const noexcept = 0;
+    [[nodiscard]] virtual bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept = 0;
     [[nodiscard]] virtual bool bounding_box(double time0, double time1, aabb &output_box) const noexcept = 0;
+
+    // Whether anything blocks r within [t_min, t_max], for visibility tests such as shadow rays. Unlike hit, this may
+    // stop at the first intersection it finds, in any order, and fills in no hit record. By default it falls back on
+    // hit; hittables override it where they can do less work. The generator is for media, whose hits are random.
+    [[nodiscard]] virtual bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept {
+        hit_record rec;
+        return hit(r, t_min, t_max, rec, gen);
+    }
+
+    // For sampling the hittable as a light (see lights.h): the density, per unit solid angle at o, with which random
+    // picks the direction v, and a direction from o to a random point of the hittable. Only the shapes that can be
+    // sampled as lights implement these.
+    [[nodiscard]] virtual double pdf_value(const point3 &o, const vec3 &v, rng &gen) const noexcept {
+        return 0;
+    }
+
+    [[nodiscard]] virtual vec3 random(const point3 &o, rng &gen) const noexcept {
+        return vec3{1, 0, 0};
+    }
+
+    // Intersect the active lanes of a packet, returning the lanes that hit. A lane that hits gets its hit record
+    // filled in and its t_max lowered to the hit. By default the lanes are traced one ray at a time; aggregates that
+    // can test several rays at once override this.
+    [[nodiscard]] virtual std::uint32_t hit_packet(ray_packet &packet,
+                                                   std::uint32_t active,
+                                                   double t_min) const noexcept {
+        std::uint32_t hits = 0;
+        for (; active; active &= active - 1) {
+            const auto k = std::countr_zero(active);
+            if (hit(packet.rays[k], t_min, packet.t_max[k], *packet.recs[k], *packet.gens[k])) {
+                packet.t_max[k] = packet.recs[k]->t;
+                hits |= 1u << k;
+            }
+        }
+        return hits;
+    }
 };
 
 class translate final : public hittable {
@@ -43,9 +85,9 @@ public:
     translate(shared_ptr<hittable> ptr, const vec3 &offset) noexcept
     : ptr{std::move(ptr)}, offset{offset} {}
 
-    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const noexcept override {
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
         const ray moved_r{r.origin() - offset, r.direction(), r.time()};
-        if (!ptr->hit(moved_r, t_min, t_max, rec))
+        if (!ptr->hit(moved_r, t_min, t_max, rec, gen))
             return false;
 
         rec.p += offset;
@@ -53,6 +95,10 @@ public:
         return true;
     }
 
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        return ptr->occluded(ray{r.origin() - offset, r.direction(), r.time()}, t_min, t_max, gen);
+    }
+
     [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
         if (!ptr->bounding_box(time0, time1, output_box))
             return false;
@@ -102,18 +148,9 @@ public:
         bbox = aabb{min, max};
     }
 
-    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const noexcept override {
-        auto origin = r.origin();
-        auto direction = r.direction();
-
-        origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
-        origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
-
-        direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
-        direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-
-        const ray rotated_r{origin, direction, r.time()};
-        if (!ptr->hit(rotated_r, t_min, t_max, rec))
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
+        const auto rotated_r = rotate(r);
+        if (!ptr->hit(rotated_r, t_min, t_max, rec, gen))
             return false;
 
         auto p = rec.p;
@@ -130,8 +167,27 @@ public:
         return true;
     }
 
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        return ptr->occluded(rotate(r), t_min, t_max, gen);
+    }
+
     [[nodiscard]] bool bounding_box(double time0, double tim1, aabb &output_box) const noexcept override {
         output_box = bbox;
         return hasbox;
     }
+
+private:
+    // r in the frame of the object, which is rotated the other way.
+    [[nodiscard]] ray rotate(const ray &r) const noexcept {
+        auto origin = r.origin();
+        auto direction = r.direction();
+
+        origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
+        origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
+
+        direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
+        direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
+
+        return ray{origin, direction, r.time()};
+    }
 };
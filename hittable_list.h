@@ -28,22 +28,37 @@ public:
         objects.emplace_back(object);
     }
 
-    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const noexcept override {
-        hit_record temp_rec;
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
         auto hit_anything = false;
         auto closest_so_far = t_max;
 
+        // A hittable only writes the record when it finds a hit, and then the hit is the closest so far.
         for (const auto &object: objects) {
-            if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+            if (object->hit(r, t_min, closest_so_far, rec, gen)) {
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = rec.t;
             }
         }
 
         return hit_anything;
     }
 
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        for (const auto &object: objects)
+            if (object->occluded(r, t_min, t_max, gen))
+                return true;
+        return false;
+    }
+
+    [[nodiscard]] std::uint32_t hit_packet(ray_packet &packet,
+                                           std::uint32_t active,
+                                           double t_min) const noexcept override {
+        std::uint32_t hits = 0;
+        for (const auto &object: objects)
+            hits |= object->hit_packet(packet, active, t_min);
+        return hits;
+    }
+
     [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
         if (objects.empty())
             return false;
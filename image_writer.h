@@ -0,0 +1,301 @@
+/**
+ * image_writer.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef RTWEEKEND_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "color.h"
+#include "rtweekend.h"
+
+// A finished image in linear HDR: width * height RGB float triples, top scanline first.
+struct hdr_image final {
+    int width = 0;
+    int height = 0;
+    std::vector<float> rgb;
+};
+
+// Average accumulated samples into a linear image.
+// pixel(i, j) gives the summed color of a pixel and samples(i, j) the number of samples in that sum.
+template<typename PixelFn, typename SamplesFn>
+[[nodiscard]] hdr_image resolve(int width, int height, PixelFn pixel, SamplesFn samples) {
+    hdr_image img{width, height, std::vector<float>(static_cast<std::size_t>(width) * height * 3)};
+    auto out = img.rgb.data();
+    for (auto j = height - 1; j >= 0; --j)
+        for (auto i = 0; i < width; ++i) {
+            const auto n = samples(i, j);
+            const auto c = n > 0 ? pixel(i, j) / static_cast<double>(n) : BLACK;
+            *out++ = static_cast<float>(c.x());
+            *out++ = static_cast<float>(c.y());
+            *out++ = static_cast<float>(c.z());
+        }
+    return img;
+}
+
+// Encodes a finished image into the bytes of one file format. Files are written with a single bulk write.
+class image_writer {
+protected:
+    using bytes = std::vector<char>;
+
+    static void append(bytes &out, const void *data, std::size_t size) {
+        const auto p = static_cast<const char*>(data);
+        out.insert(out.end(), p, p + size);
+    }
+
+    static void append(bytes &out, const std::string &s) {
+        out.insert(out.end(), s.begin(), s.end());
+    }
+
+    [[nodiscard]] static std::vector<std::uint8_t> quantized(const hdr_image &img) {
+        std::vector<std::uint8_t> out(img.rgb.size());
+        quantize(img.rgb.data(), out.data(), img.rgb.size());
+        return out;
+    }
+
+public:
+    virtual ~image_writer() = default;
+
+    [[nodiscard]] virtual bytes encode(const hdr_image &img) const = 0;
+
+    [[nodiscard]] bool write(const std::string &path, const hdr_image &img) const {
+        const auto data = encode(img);
+        std::ofstream out{path, std::ios::binary};
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!out) {
+            std::cerr << "ERROR: Could not write image file: '" << path << "'\n";
+            return false;
+        }
+        return true;
+    }
+};
+
+// Binary PPM (P6), gamma-corrected 8 bits per channel.
+class ppm_writer final : public image_writer {
+public:
+    [[nodiscard]] bytes encode(const hdr_image &img) const override {
+        bytes out;
+        append(out, "P6\n" + std::to_string(img.width) + ' ' + std::to_string(img.height) + "\n255\n");
+        const auto pixels = quantized(img);
+        append(out, pixels.data(), pixels.size());
+        return out;
+    }
+};
+
+// Portable float map: linear 32-bit RGB, little-endian, bottom scanline first.
+class pfm_writer final : public image_writer {
+public:
+    [[nodiscard]] bytes encode(const hdr_image &img) const override {
+        bytes out;
+        append(out, "PF\n" + std::to_string(img.width) + ' ' + std::to_string(img.height) + "\n-1.0\n");
+        const auto row = static_cast<std::size_t>(img.width) * 3;
+        for (auto j = img.height - 1; j >= 0; --j)
+            append(out, img.rgb.data() + j * row, row * sizeof(float));
+        return out;
+    }
+};
+
+// PNG, gamma-corrected 8 bits per channel. The image data is deflated with zlib when it is available, and otherwise
+// stored uncompressed.
+class png_writer final : public image_writer {
+private:
+    [[nodiscard]] static std::uint32_t crc32(const char *data, std::size_t size) noexcept {
+        static const auto table = [] {
+            std::array<std::uint32_t, 256> t{};
+            for (std::uint32_t n = 0; n < 256; ++n) {
+                auto c = n;
+                for (auto k = 0; k < 8; ++k)
+                    c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                t[n] = c;
+            }
+            return t;
+        }();
+
+        auto c = 0xffffffffu;
+        for (std::size_t i = 0; i < size; ++i)
+            c = table[(c ^ static_cast<std::uint8_t>(data[i])) & 0xff] ^ (c >> 8);
+        return c ^ 0xffffffffu;
+    }
+
+    static void append_be32(bytes &out, std::uint32_t v) {
+        const char b[4] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16),
+                           static_cast<char>(v >> 8), static_cast<char>(v)};
+        append(out, b, 4);
+    }
+
+    static void append_chunk(bytes &out, const char *type, const bytes &data) {
+        append_be32(out, static_cast<std::uint32_t>(data.size()));
+        const auto start = out.size();
+        append(out, type, 4);
+        append(out, data.data(), data.size());
+        append_be32(out, crc32(out.data() + start, out.size() - start));
+    }
+
+    [[nodiscard]] static bytes deflate(const std::vector<std::uint8_t> &raw) {
+#ifdef RTWEEKEND_HAVE_ZLIB
+        // Should zlib fail, say for lack of memory, the data are still written, only uncompressed.
+        auto size = compressBound(static_cast<uLong>(raw.size()));
+        bytes out(size);
+        if (compress2(reinterpret_cast<Bytef*>(out.data()), &size, raw.data(), static_cast<uLong>(raw.size()), 6)
+            == Z_OK) {
+            out.resize(size);
+            return out;
+        }
+#endif
+        return store(raw);
+    }
+
+    // A zlib stream of stored blocks, followed by the Adler-32 of the data.
+    [[nodiscard]] static bytes store(const std::vector<std::uint8_t> &raw) {
+        bytes out{0x78, 0x01};
+        std::size_t pos = 0;
+        do {
+            const auto len = static_cast<std::uint16_t>(std::min<std::size_t>(raw.size() - pos, 0xffff));
+            const auto last = pos + len == raw.size();
+            const char block[5] = {static_cast<char>(last ? 1 : 0),
+                                   static_cast<char>(len & 0xff), static_cast<char>(len >> 8),
+                                   static_cast<char>(~len & 0xff), static_cast<char>((~len >> 8) & 0xff)};
+            append(out, block, 5);
+            append(out, raw.data() + pos, len);
+            pos += len;
+        } while (pos < raw.size());
+
+        std::uint32_t a = 1, b = 0;
+        for (const auto byte: raw) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        append_be32(out, (b << 16) | a);
+        return out;
+    }
+
+public:
+    [[nodiscard]] bytes encode(const hdr_image &img) const override {
+        const auto pixels = quantized(img);
+
+        // Every scanline is preceded by its filter type, which is always 0 (none).
+        const auto row = static_cast<std::size_t>(img.width) * 3;
+        std::vector<std::uint8_t> raw(img.height * (row + 1));
+        for (auto j = 0; j < img.height; ++j)
+            std::memcpy(raw.data() + j * (row + 1) + 1, pixels.data() + j * row, row);
+
+        bytes out{'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+
+        bytes header;
+        append_be32(header, img.width);
+        append_be32(header, img.height);
+        // 8 bits per channel, RGB, deflate, no filtering, no interlacing.
+        append(header, "\x08\x02\x00\x00\x00", 5);
+
+        append_chunk(out, "IHDR", header);
+        append_chunk(out, "IDAT", deflate(raw));
+        append_chunk(out, "IEND", {});
+        return out;
+    }
+};
+
+// OpenEXR: linear 32-bit float RGB, single-part scanline file without compression.
+class exr_writer final : public image_writer {
+private:
+    template<typename T>
+    static void append_value(bytes &out, T v) {
+        append(out, &v, sizeof(T));
+    }
+
+    static void append_attribute(bytes &out, const std::string &name, const std::string &type, const bytes &value) {
+        append(out, name.c_str(), name.size() + 1);
+        append(out, type.c_str(), type.size() + 1);
+        append_value(out, static_cast<std::int32_t>(value.size()));
+        append(out, value.data(), value.size());
+    }
+
+public:
+    [[nodiscard]] bytes encode(const hdr_image &img) const override {
+        constexpr std::int32_t float_type = 2;
+        const std::array<char, 3> channels{'B', 'G', 'R'};
+
+        bytes out;
+        append_value(out, std::uint32_t{20000630});
+        append_value(out, std::uint32_t{2});
+
+        bytes chlist;
+        for (const auto c: channels) {
+            append(chlist, &c, 1);
+            append(chlist, "\0", 1);
+            append_value(chlist, float_type);
+            // pLinear and three reserved bytes.
+            append_value(chlist, std::uint32_t{0});
+            append_value(chlist, std::int32_t{1});
+            append_value(chlist, std::int32_t{1});
+        }
+        append(chlist, "\0", 1);
+        append_attribute(out, "channels", "chlist", chlist);
+
+        append_attribute(out, "compression", "compression", bytes{0});
+
+        bytes window;
+        for (const auto v: {0, 0, img.width - 1, img.height - 1})
+            append_value(window, std::int32_t{v});
+        append_attribute(out, "dataWindow", "box2i", window);
+        append_attribute(out, "displayWindow", "box2i", window);
+
+        append_attribute(out, "lineOrder", "lineOrder", bytes{0});
+
+        bytes one;
+        append_value(one, 1.0f);
+        append_attribute(out, "pixelAspectRatio", "float", one);
+        append_attribute(out, "screenWindowCenter", "v2f", bytes(8, 0));
+        append_attribute(out, "screenWindowWidth", "float", one);
+        append(out, "\0", 1);
+
+        // Offset table, then one block per scanline holding each channel's row in alphabetical channel order.
+        const auto data_size = static_cast<std::int32_t>(img.width * channels.size() * sizeof(float));
+        const auto block_size = 2 * sizeof(std::int32_t) + data_size;
+        const auto first_block = out.size() + img.height * sizeof(std::uint64_t);
+        for (auto j = 0; j < img.height; ++j)
+            append_value(out, static_cast<std::uint64_t>(first_block + j * block_size));
+
+        std::vector<float> line(img.width);
+        for (auto j = 0; j < img.height; ++j) {
+            append_value(out, std::int32_t{j});
+            append_value(out, data_size);
+            const auto row = img.rgb.data() + static_cast<std::size_t>(j) * img.width * 3;
+            for (const auto c: {2, 1, 0}) {
+                for (auto i = 0; i < img.width; ++i)
+                    line[i] = row[3 * i + c];
+                append(out, line.data(), line.size() * sizeof(float));
+            }
+        }
+        return out;
+    }
+};
+
+// Pick a writer from the file extension: .png, .pfm, .exr, and binary PPM for anything else.
+[[nodiscard]] shared_ptr<image_writer> make_image_writer(const std::string &path) {
+    const auto dot = path.rfind('.');
+    const auto ext = dot == std::string::npos ? std::string{} : path.substr(dot + 1);
+    if (ext == "png")
+        return make_shared<png_writer>();
+    if (ext == "pfm")
+        return make_shared<pfm_writer>();
+    if (ext == "exr")
+        return make_shared<exr_writer>();
+    return make_shared<ppm_writer>();
+}
+
+bool write_image(const std::string &path, const hdr_image &img) {
+    return make_image_writer(path)->write(path, img);
+}
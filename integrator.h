@@ -0,0 +1,179 @@
+/**
+ * integrator.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "lights.h"
+#include "material.h"
+#include "material_table.h"
+#include "ray.h"
+#include "sampler.h"
+#include "sampling.h"
+
+// Limits on the length of a path. max_depth bounds the number of rays cast, and each bounce type can be limited on
+// its own, e.g. to keep glass paths long while cutting diffuse interreflection short. Paths that have bounced at
+// least roulette_depth times are also terminated by Russian roulette.
+struct path_limits final {
+    int max_depth = 50;
+    std::array<int, 4> max_bounces{50, 50, 50, 50};
+    bool russian_roulette = true;
+    int roulette_depth = 3;
+
+    [[nodiscard]] int max_of(bounce_type type) const noexcept {
+        return max_bounces[static_cast<int>(type)];
+    }
+};
+
+// Counts of traced paths and the rays cast along them, for reporting the average path length.
+struct path_stats final {
+    std::uint64_t paths = 0;
+    std::uint64_t rays = 0;
+
+    path_stats &operator+=(const path_stats &other) noexcept {
+        paths += other.paths;
+        rays += other.rays;
+        return *this;
+    }
+
+    [[nodiscard]] double average_length() const noexcept {
+        return paths > 0 ? static_cast<double>(rays) / static_cast<double>(paths) : 0.0;
+    }
+};
+
+// What a path carries from one vertex to the next: the fraction of the light found further along it that reaches the
+// camera, the bounces of each type it has taken, and what its multiple importance sampling needs.
+struct path_state final {
+    color throughput{1, 1, 1};
+    std::array<int, 4> bounces{0, 0, 0, 0};
+    mis_state weights;
+};
+
+// What shading a vertex leaves the tracer to do.
+struct vertex_result final {
+    // Whether the vertex sampled a light, whose shadow ray is yet to be traced.
+    bool shadow = false;
+
+    // Whether the path goes on along the scattered ray.
+    bool next = false;
+};
+
+// Shade rec, the hit of r, which is the depth-th ray of a path: gather the light it emits into radiance, sample the
+// lights, and scatter r into the next ray of the path. A light sample is left in shadow, its light already carried
+// through the throughput, for the tracer to trace at once or with others later. The bounce takes its samples from
+// point if there is one, and otherwise from gen. Both tracers shade every vertex here.
+[[nodiscard]] vertex_result shade_vertex(ray &r,
+                                         hit_record &rec,
+                                         int depth,
+                                         path_state &state,
+                                         color &radiance,
+                                         shadow_ray &shadow,
+                                         const path_limits &limits,
+                                         const light_list *lights,
+                                         bool mis,
+                                         sample_point *point,
+                                         rng &gen) noexcept {
+    vertex_result result;
+
+    const auto &m = scene_materials[rec.mat];
+    if (m.emits) {
+        const auto weight = state.weights.emission_weight(lights, mis, r, rec, gen);
+        if (weight > 0)
+            radiance += state.throughput * m.emitted(rec.u, rec.v, rec.p) * weight;
+    }
+
+    if (state.weights.sample_lights(lights, m) && lights->sample(r, rec, m, mis, gen, shadow)) {
+        shadow.light = state.throughput * shadow.light;
+        result.shadow = true;
+    }
+
+    ray scattered;
+    color attenuation;
+    auto u = point ? point->bounce(gen) : bounce_sample{gen};
+    if (!m.scatter(r, rec, u, attenuation, scattered, gen))
+        return result;
+    state.weights.scattered(m, mis, r, rec, scattered.direction());
+
+    const auto type = m.bounce;
+    if (++state.bounces[static_cast<int>(type)] > limits.max_of(type))
+        return result;
+
+    state.throughput = state.throughput * attenuation;
+    r = scattered;
+
+    // Russian roulette: continue with a probability that follows the throughput, and reweight the survivors so the
+    // estimate stays unbiased. The floor keeps the weights of surviving dim paths bounded.
+    if (limits.russian_roulette && depth + 1 >= limits.roulette_depth) {
+        const auto &t = state.throughput;
+        const auto p = clamp(std::max({t.x(), t.y(), t.z()}), 0.05, 1.0);
+        if (random_double(gen) >= p)
+            return result;
+        state.throughput /= p;
+    }
+
+    result.next = true;
+    return result;
+}
+
+// Trace a path from r, carrying the throughput and gathered radiance along in a loop instead of recursing.
+// The first ray has already been intersected with the world, so that camera rays can be traced in packets: hit tells
+// whether it hit anything and rec holds the hit if so. With a list of lights, the path samples them at each
+// non-specular hit (see lights.h), and with mis, weights those samples against its bounces. With a sample point, the
+// bounces take their directions from it (see sampler.h), and otherwise from gen.
+[[nodiscard]] color continue_path(ray r,
+                                  bool hit,
+                                  hit_record &rec,
+                                  const color &background,
+                                  const hittable &world,
+                                  const path_limits &limits,
+                                  rng &gen,
+                                  path_stats &stats,
+                                  const light_list *lights = nullptr,
+                                  bool mis = true,
+                                  sample_point *point = nullptr) noexcept {
+    color radiance{0, 0, 0};
+    path_state state;
+    shadow_ray shadow;
+
+    ++stats.paths;
+    for (auto depth = 0; depth < limits.max_depth; ++depth) {
+        ++stats.rays;
+        if (depth > 0)
+            hit = world.hit(r, ray_t_min, infinity, rec, gen);
+
+        // If the ray hits nothing, it gathers the background color.
+        if (!hit) {
+            radiance += state.throughput * background;
+            break;
+        }
+
+        const auto result = shade_vertex(r, rec, depth, state, radiance, shadow, limits, lights, mis, point, gen);
+        if (result.shadow && !light_list::occluded(world, shadow))
+            radiance += shadow.light;
+        if (!result.next)
+            break;
+    }
+
+    return radiance;
+}
+
+[[nodiscard]] color trace_path(const ray &r,
+                               const color &background,
+                               const hittable &world,
+                               const path_limits &limits,
+                               rng &gen,
+                               path_stats &stats,
+                               const light_list *lights = nullptr,
+                               bool mis = true,
+                               sample_point *point = nullptr) noexcept {
+    hit_record rec;
+    const auto hit = world.hit(r, ray_t_min, infinity, rec, gen);
+    return continue_path(r, hit, rec, background, world, limits, gen, stats, lights, mis, point);
+}
@@ -0,0 +1,251 @@
+/**
+ * lights.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "constant_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "material_table.h"
+#include "motion_bvh.h"
+#include "moving_sphere.h"
+#include "primitive.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "wide_bvh.h"
+
+// The weight that multiple importance sampling gives a sample picked with density pdf, when the other strategy would
+// have picked it with density other: Veach's power heuristic with an exponent of 2.
+[[nodiscard]] inline double power_heuristic(double pdf, double other) noexcept {
+    const auto p2 = pdf * pdf;
+    const auto o2 = other * other;
+    return p2 + o2 > 0 ? p2 / (p2 + o2) : 0;
+}
+
+// A sampled point on a light whose shadow ray is yet to be traced: the light it brings if nothing blocks r short of
+// t_max. Media may block a ray at random, so the test draws from a stream of its own, which the sample seeds; it then
+// gives the same answer whether it is made at once or later in a batch.
+struct shadow_ray final {
+    ray r;
+    double t_max = 0;
+    color light{0, 0, 0};
+    rng gen{0};
+};
+
+// The emissive rects and spheres of a scene, for next-event estimation: at each non-specular hit, the integrators
+// sample a point on a light and add the light it sends along a shadow ray that nothing blocks, instead of waiting for
+// a bounce to hit the light by chance.
+//
+// Light samples do well on small lights, and bounces do well on glossy surfaces and on large lights close by, whose
+// light samples have a large geometry term. With multiple importance sampling, both are kept and weighted by the
+// power heuristic: a light sample by its density against that of the bounce picking the same direction, and a
+// bounce that hits a light by its density against that of the light sample.
+//
+// The lights are gathered from the built scene. Only the shapes that can be sampled, in world space, are gathered:
+// emitters under a translate or a rotate_y, moving spheres and spheres packed into sphere_sets are left to be found by
+// bounces, as are materials that are not diffuse_light. A hit on an emitter counts its emission unless the path has
+// just sampled the lights and every emitter with the hit's material is in the list, and light samples only count the
+// emitters whose materials are covered that way, so no light is counted twice. A hittable of a class the walk does not
+// know may hold emitters of any material, so if there is one, no material is covered: hits count all emission and
+// light samples none, which is unbiased, if noisier.
+class light_list final {
+public:
+    std::vector<std::shared_ptr<hittable>> lights;
+
+    light_list() = default;
+
+    explicit light_list(const hittable &world) {
+        collect(world, true);
+    }
+
+    [[nodiscard]] bool empty() const noexcept {
+        return lights.empty();
+    }
+
+    // Whether every emitter with the material is in the list.
+    [[nodiscard]] bool sampled(material_id id) const noexcept {
+        return complete && id < coverage.size() && coverage[id] == all_gathered;
+    }
+
+    // Sample a point on one of the lights, chosen uniformly, for a hit rec on a material m that samples lights: the
+    // shadow ray to it, and the light it scatters back along r_in if nothing blocks that ray, divided by the density of
+    // the sample. With mis, the sample is weighted against m's scattering. Returns false if the sample brings no light
+    // whether or not it is blocked.
+    [[nodiscard]] bool sample(const ray &r_in,
+                              const hit_record &rec,
+                              const material_record &m,
+                              bool mis,
+                              rng &gen,
+                              shadow_ray &shadow) const noexcept {
+        const auto n = lights.size();
+        const auto &light = *lights[std::min(static_cast<std::size_t>(random_double(gen) * n), n - 1)];
+
+        const auto to_light = light.random(rec.p, gen);
+        const auto distance = to_light.length();
+        if (!(distance > 0))
+            return false;
+        shadow.r = ray{rec.p, to_light / distance, r_in.time()};
+
+        hit_record light_rec;
+        if (!light.hit(shadow.r, ray_t_min, infinity, light_rec, gen) || !sampled(light_rec.mat))
+            return false;
+
+        const auto f = m.scattering(r_in, rec, shadow.r.direction());
+        if (f.x() == 0 && f.y() == 0 && f.z() == 0)
+            return false;
+
+        const auto pdf = light.pdf_value(rec.p, shadow.r.direction(), gen) / static_cast<double>(n);
+        if (!(pdf > 0))
+            return false;
+
+        const auto weight = mis ? power_heuristic(pdf, m.pdf(r_in, rec, shadow.r.direction())) : 1.0;
+        shadow.t_max = light_rec.t - ray_t_min;
+        const auto &emitter = scene_materials[light_rec.mat];
+        shadow.light = f * emitter.emitted(light_rec.u, light_rec.v, light_rec.p) * (weight / pdf);
+        shadow.gen = rng{rng::mix64(gen.next_uint())};
+        return true;
+    }
+
+    // Whether anything in world blocks a shadow ray.
+    [[nodiscard]] static bool occluded(const hittable &world, shadow_ray &shadow) noexcept {
+        return world.occluded(shadow.r, ray_t_min, shadow.t_max, shadow.gen);
+    }
+
+    // The density with which sample would have chosen the point at t along r, which is on one of the lights.
+    [[nodiscard]] double pdf(const ray &r, double t, rng &gen) const noexcept {
+        auto sum = 0.0;
+        for (const auto &light: lights) {
+            hit_record light_rec;
+            if (light->hit(r, ray_t_min, infinity, light_rec, gen) && std::fabs(light_rec.t - t) <= 1e-4 * t)
+                sum += light->pdf_value(r.origin(), r.direction(), gen);
+        }
+        return sum / static_cast<double>(lights.size());
+    }
+
+private:
+    // For each material, whether emitters with it have been seen, and whether all of them were gathered.
+    enum coverage_state : std::uint8_t {
+        unseen,
+        all_gathered,
+        some_missed,
+    };
+    std::vector<coverage_state> coverage;
+
+    // Whether the walk knew every hittable of the scene.
+    bool complete = true;
+
+    // Gather object if it is an emitter that can be sampled, and note what was seen of its material.
+    template<typename T>
+    void consider(const T &object, material_id mat, bool gather) {
+        if (scene_materials[mat].kind != material_kind::diffuse_light)
+            return;
+        if (mat >= coverage.size())
+            coverage.resize(mat + 1, unseen);
+        if (gather)
+            lights.emplace_back(make_shared<T>(object));
+        coverage[mat] = gather && coverage[mat] != some_missed ? all_gathered : some_missed;
+    }
+
+    // Walk the scene, down through its lists, BVHs and transforms. Shapes under a transform are not in world space.
+    void collect(const hittable &object, bool world_space) {
+        const auto p = &object;
+        if (const auto l = dynamic_cast<const hittable_list*>(p)) {
+            for (const auto &o: l->objects)
+                collect(*o, world_space);
+        } else if (const auto n = dynamic_cast<const bvh_node*>(p)) {
+            collect(*n->left, world_space);
+            if (n->right != n->left)
+                collect(*n->right, world_space);
+        } else if (const auto b = dynamic_cast<const linear_bvh*>(p)) {
+            collect(b->primitives, world_space);
+        } else if (const auto w4 = dynamic_cast<const wide_bvh<4>*>(p)) {
+            collect(w4->primitives, world_space);
+        } else if (const auto w8 = dynamic_cast<const wide_bvh<8>*>(p)) {
+            collect(w8->primitives, world_space);
+        } else if (const auto m = dynamic_cast<const motion_bvh*>(p)) {
+            collect(m->primitives, world_space);
+        } else if (const auto v = dynamic_cast<const primitive_bvh*>(p)) {
+            for (const auto &primitive: v->primitives)
+                std::visit([&](const auto &o) {
+                    if constexpr (std::is_same_v<std::decay_t<decltype(o)>, std::shared_ptr<hittable>>)
+                        collect(*o, world_space);
+                    else
+                        collect(o, world_space);
+                }, primitive);
+        } else if (const auto s = dynamic_cast<const sphere*>(p)) {
+            consider(*s, s->mat, world_space);
+        } else if (const auto r = dynamic_cast<const xy_rect*>(p)) {
+            consider(*r, r->mat, world_space);
+        } else if (const auto r = dynamic_cast<const xz_rect*>(p)) {
+            consider(*r, r->mat, world_space);
+        } else if (const auto r = dynamic_cast<const yz_rect*>(p)) {
+            consider(*r, r->mat, world_space);
+        } else if (const auto s = dynamic_cast<const moving_sphere*>(p)) {
+            consider(*s, s->mat, false);
+        } else if (const auto s = dynamic_cast<const sphere_set*>(p)) {
+            for (auto k = 0; k < s->size(); ++k)
+                consider(*s, s->material_of(k), false);
+        } else if (const auto b = dynamic_cast<const box*>(p)) {
+            collect(b->sides, world_space);
+        } else if (const auto t = dynamic_cast<const translate*>(p)) {
+            collect(*t->ptr, false);
+        } else if (const auto r = dynamic_cast<const rotate_y*>(p)) {
+            collect(*r->ptr, false);
+        } else if (dynamic_cast<const constant_medium*>(p)) {
+            // Its hits are on its phase function, which does not emit.
+        } else if (const auto d = dynamic_cast<const basic_sphere<double>*>(p)) {
+            consider(*d, d->mat, world_space);
+        } else {
+            complete = false;
+        }
+    }
+
+    void collect(const std::vector<std::shared_ptr<hittable>> &objects, bool world_space) {
+        for (const auto &o: objects)
+            collect(*o, world_space);
+    }
+};
+
+// The multiple importance sampling of a path, which weighs the light that its hits emit against the light samples of
+// the vertices before them: whether the last vertex sampled the lights, which then already account for the light the
+// next hit may emit, and the density with which it picked the ray to that hit.
+struct mis_state final {
+    bool sampled_lights = false;
+    double scatter_pdf = 0.0;
+
+    // Whether the vertex at a hit on m samples the lights.
+    bool sample_lights(const light_list *lights, const material_record &m) noexcept {
+        sampled_lights = lights && m.samples_lights();
+        return sampled_lights;
+    }
+
+    // Note that the vertex at rec, the hit of r_in on m, scattered into direction.
+    void scattered(const material_record &m, bool mis, const ray &r_in, const hit_record &rec,
+                   const vec3 &direction) noexcept {
+        if (sampled_lights && mis)
+            scatter_pdf = m.pdf(r_in, rec, direction);
+    }
+
+    // The weight of the light emitted at rec, the hit of r: 1 unless the last vertex sampled the lights that cover its
+    // material, and then, with mis, that of the bounce against the light sample, and without, 0.
+    [[nodiscard]] double emission_weight(const light_list *lights, bool mis, const ray &r, const hit_record &rec,
+                                         rng &gen) const noexcept {
+        if (!sampled_lights || !lights->sampled(rec.mat))
+            return 1.0;
+        return mis ? power_heuristic(scatter_pdf, lights->pdf(r, rec.t, gen)) : 0.0;
+    }
+};
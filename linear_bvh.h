@@ -0,0 +1,302 @@
+/**
+ * linear_bvh.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "rtweekend.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+// A BVH compiled into one contiguous array of compact nodes in depth-first order, so that the first child of an
+// interior node directly follows it and only the second child needs an offset. The primitives are stored in the order
+// the leaves reference them. Traversal is an iterative loop over a small stack of node indices: there are no virtual
+// calls or reference counts between the root and the primitives.
+class linear_bvh final : public hittable {
+public:
+    struct node final {
+        aabb box;
+
+        // For a leaf, the index of its first primitive. For an interior node, the index of its second child.
+        std::uint32_t offset = 0;
+
+        // The number of primitives in a leaf, and 0 for an interior node.
+        std::uint16_t count = 0;
+
+        // The axis the children are ordered along, to visit the nearer child first.
+        std::uint8_t axis = 0;
+    };
+
+    // Counts of the work done by traversals, for judging the quality of a tree (see bvh_stats.h).
+    struct traversal_stats final {
+        std::uint64_t rays = 0;
+        std::uint64_t node_visits = 0;
+        std::uint64_t primitive_tests = 0;
+    };
+
+    std::vector<node> nodes;
+    std::vector<std::shared_ptr<hittable>> primitives;
+
+    explicit linear_bvh(const hittable_list &list)
+    : linear_bvh(list, 0.0, 0.0) {}
+
+    linear_bvh(const hittable_list &list, double time0, double time1)
+    : linear_bvh(bvh_node{list, time0, time1}, time0, time1) {}
+
+    // Compile a built bvh_node tree. Nested bvh_nodes are flattened into this array, and every other hittable becomes
+    // a primitive. A node whose children are both primitives becomes a leaf.
+    linear_bvh(const bvh_node &root, double time0, double time1) {
+        flatten(root, time0, time1);
+    }
+
+    // Adopt nodes and primitives laid out by a builder (see bvh_builder.h).
+    linear_bvh(std::vector<node> nodes, std::vector<std::shared_ptr<hittable>> primitives) noexcept
+    : nodes{std::move(nodes)}, primitives{std::move(primitives)} {}
+
+    // Traversal stacks hold this many levels, so builders must not build deeper trees.
+    static constexpr int max_depth = 96;
+
+    [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
+        output_box = nodes.front().box;
+        return true;
+    }
+
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
+        return traverse(nodes, pointer_leaves{primitives}, 0, r, t_min, t_max, rec, gen);
+    }
+
+    // hit, counting the nodes it visits and the primitives it tests in stats.
+    [[nodiscard]] bool hit(const ray &r,
+                           double t_min,
+                           double t_max,
+                           hit_record &rec,
+                           rng &gen,
+                           traversal_stats &stats) const noexcept {
+        ++stats.rays;
+        return traverse<true>(nodes, pointer_leaves{primitives}, 0, r, t_min, t_max, rec, gen, &stats);
+    }
+
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        hit_record unused;
+        return traverse<false, true>(nodes, pointer_leaves{primitives}, 0, r, t_min, t_max, unused, gen);
+    }
+
+    // occluded, counting the nodes it visits and the primitives it tests in stats.
+    [[nodiscard]] bool occluded(const ray &r,
+                                double t_min,
+                                double t_max,
+                                rng &gen,
+                                traversal_stats &stats) const noexcept {
+        ++stats.rays;
+        hit_record unused;
+        return traverse<true, true>(nodes, pointer_leaves{primitives}, 0, r, t_min, t_max, unused, gen, &stats);
+    }
+
+    [[nodiscard]] std::uint32_t hit_packet(ray_packet &packet,
+                                           std::uint32_t active,
+                                           double t_min) const noexcept override {
+        return traverse_packet(nodes, pointer_leaves{primitives}, packet, active, t_min);
+    }
+
+    // Traverse the subtree of nodes rooted at nodes[start]. Counted traversals also tally their work in stats. Any-hit
+    // traversals return at the first primitive that occludes the ray, and leave rec alone.
+    // The traversals are generic over how the primitives of a leaf are stored and intersected, so that trees of other
+    // primitives (see primitive.h) share them: Leaves intersects the primitive with index p through
+    // hit(p, r, t_min, t_max, rec, gen), occluded(p, r, t_min, t_max, gen), and hit_packet(p, packet, active, t_min),
+    // which work as those of hittable.
+    template<bool Counted = false, bool AnyHit = false, typename Leaves>
+    [[nodiscard]] static bool traverse(const std::vector<node> &nodes,
+                                       const Leaves &leaves,
+                                       std::uint32_t start,
+                                       const ray &r,
+                                       double t_min,
+                                       double t_max,
+                                       hit_record &rec,
+                                       rng &gen,
+                                       traversal_stats *stats = nullptr) noexcept {
+        const std::array<bool, 3> negative{r.direction().x() < 0, r.direction().y() < 0, r.direction().z() < 0};
+        std::array<std::uint32_t, max_depth> stack;
+        auto top = 0;
+        auto index = start;
+        auto hit_anything = false;
+
+        while (true) {
+            const auto &n = nodes[index];
+            if constexpr (Counted)
+                ++stats->node_visits;
+            if (n.box.hit(r, t_min, t_max)) {
+                if (n.count == 0) {
+                    // Descend into the nearer child and come back for the other.
+                    if (negative[n.axis]) {
+                        stack[top++] = index + 1;
+                        index = n.offset;
+                    } else {
+                        stack[top++] = n.offset;
+                        index = index + 1;
+                    }
+                    continue;
+                }
+
+                if constexpr (Counted)
+                    stats->primitive_tests += n.count;
+                for (auto p = n.offset; p < n.offset + n.count; ++p) {
+                    if constexpr (AnyHit) {
+                        if (leaves.occluded(p, r, t_min, t_max, gen))
+                            return true;
+                    } else if (leaves.hit(p, r, t_min, t_max, rec, gen)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+            }
+
+            if (top == 0)
+                break;
+            index = stack[--top];
+        }
+
+        return hit_anything;
+    }
+
+    // Traverse nodes with the active lanes of a packet, as hittable::hit_packet.
+    template<typename Leaves>
+    [[nodiscard]] static std::uint32_t traverse_packet(const std::vector<node> &nodes,
+                                                       const Leaves &leaves,
+                                                       ray_packet &packet,
+                                                       std::uint32_t active,
+                                                       double t_min) noexcept {
+        // The lanes travelling down each axis, which visit the upper child first.
+        std::array<std::uint32_t, 3> negative{0, 0, 0};
+        for (auto k = 0; k < packet.count; ++k)
+            for (auto a = 0; a < 3; ++a)
+                if (packet.rays[k].direction()[a] < 0)
+                    negative[a] |= 1u << k;
+
+        struct entry final {
+            std::uint32_t index;
+            std::uint32_t active;
+        };
+        std::array<entry, 4 * max_depth> stack;
+        auto top = 0;
+        stack[top++] = {0, active};
+
+        std::uint32_t hits = 0;
+        while (top > 0) {
+            const auto [index, mask] = stack[--top];
+            const auto &n = nodes[index];
+            const auto lanes = packet.hit_box(n.box, mask, t_min);
+            if (!lanes)
+                continue;
+
+            // Once too few rays are left to fill the SIMD lanes, finish this subtree one ray at a time.
+            if (!ray_packet::coherent(lanes)) {
+                for (auto bits = lanes; bits; bits &= bits - 1) {
+                    const auto k = std::countr_zero(bits);
+                    const auto &r = packet.rays[k];
+                    if (traverse(nodes, leaves, index, r, t_min, packet.t_max[k], *packet.recs[k], *packet.gens[k])) {
+                        packet.t_max[k] = packet.recs[k]->t;
+                        hits |= 1u << k;
+                    }
+                }
+                continue;
+            }
+
+            if (n.count > 0) {
+                for (auto p = n.offset; p < n.offset + n.count; ++p)
+                    hits |= leaves.hit_packet(p, packet, lanes, t_min);
+                continue;
+            }
+
+            // Each lane visits the nearer child first, as in hit. Lanes that disagree on the order are split into two
+            // groups, pushed so that each group pops its own nearer child first.
+            const auto back = lanes & negative[n.axis];
+            const auto front = lanes & ~negative[n.axis];
+            if (back) {
+                stack[top++] = {index + 1, back};
+                stack[top++] = {n.offset, back};
+            }
+            if (front) {
+                stack[top++] = {n.offset, front};
+                stack[top++] = {index + 1, front};
+            }
+        }
+
+        return hits;
+    }
+
+private:
+    // The leaves of a linear_bvh, whose primitives are intersected through their virtual calls.
+    struct pointer_leaves final {
+        const std::vector<std::shared_ptr<hittable>> &primitives;
+
+        [[nodiscard]] bool hit(std::uint32_t p,
+                               const ray &r,
+                               double t_min,
+                               double t_max,
+                               hit_record &rec,
+                               rng &gen) const noexcept {
+            return primitives[p]->hit(r, t_min, t_max, rec, gen);
+        }
+
+        [[nodiscard]] bool occluded(std::uint32_t p,
+                                    const ray &r,
+                                    double t_min,
+                                    double t_max,
+                                    rng &gen) const noexcept {
+            return primitives[p]->occluded(r, t_min, t_max, gen);
+        }
+
+        [[nodiscard]] std::uint32_t hit_packet(std::uint32_t p,
+                                               ray_packet &packet,
+                                               std::uint32_t active,
+                                               double t_min) const noexcept {
+            return primitives[p]->hit_packet(packet, active, t_min);
+        }
+    };
+
+    void flatten(const bvh_node &n, double time0, double time1) {
+        const auto left = dynamic_cast<const bvh_node*>(n.left.get());
+        const auto right = dynamic_cast<const bvh_node*>(n.right.get());
+
+        if (!left && !right) {
+            // bvh_node repeats a lone primitive as both of its children.
+            add_leaf(n.box, n.left, n.right == n.left ? nullptr : n.right);
+            return;
+        }
+
+        const auto index = nodes.size();
+        nodes.emplace_back(node{n.box, 0, 0, static_cast<std::uint8_t>(n.axis)});
+        flatten_child(left, n.left, time0, time1);
+        nodes[index].offset = static_cast<std::uint32_t>(nodes.size());
+        flatten_child(right, n.right, time0, time1);
+    }
+
+    void flatten_child(const bvh_node *child, const std::shared_ptr<hittable> &object, double time0, double time1) {
+        if (child) {
+            flatten(*child, time0, time1);
+            return;
+        }
+
+        aabb box;
+        if (!object->bounding_box(time0, time1, box))
+            std::cerr << "No bounding box in linear_bvh constructor.\n";
+        add_leaf(box, object, nullptr);
+    }
+
+    void add_leaf(const aabb &box, const std::shared_ptr<hittable> &first, const std::shared_ptr<hittable> &second) {
+        nodes.emplace_back(node{box, static_cast<std::uint32_t>(primitives.size()), 0, 0});
+        primitives.emplace_back(first);
+        if (second)
+            primitives.emplace_back(second);
+        nodes.back().count = static_cast<std::uint16_t>(primitives.size() - nodes.back().offset);
+    }
+};
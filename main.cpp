@@ -4,372 +4,312 @@
  */
 
 #include "rtweekend.h"
-#include "aarect.h"
-#include "box.h"
-#include "bvh.h"
-#include "camera.h"
-#include "color.h"
-#include "hittable_list.h"
-#include "material.h"
-#include "moving_sphere.h"
-#include "sphere.h"
-#include "constant_medium.h"
-
-#include <omp.h>
+#include "bvh_stats.h"
+#include "checkpoint.h"
+#include "framebuffer.h"
+#include "image_writer.h"
+#include "integrator.h"
+#include "pixel_stats.h"
+#include "sampler.h"
+#include "scenes.h"
+#include "scheduler.h"
+#include "wavefront.h"
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <mutex>
+#include <string>
+#include <vector>
 
-[[nodiscard]] color ray_color(const ray &r,
-                              const color &background,
-                              const hittable &world,
-                              int depth) noexcept {
-    hit_record rec;
-
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return BLACK;
-
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 1e-3, infinity, rec))
-        return background;
+int main() {
+    // Paths are cut off after 50 rays, and terminated early by Russian roulette once their throughput drops.
+    const path_limits limits;
+    const auto tile_size = 16;
+    const std::uint64_t seed = 0;
+
+    // The format is chosen from the extension: .png, .ppm (binary P6), or .pfm / .exr for the linear HDR data.
+    const std::string output_file = "image.png";
+
+    // Progressive rendering: refine the whole frame in passes of spp_per_pass samples, checkpointing the accumulated
+    // samples after each pass and writing a preview. Rerunning resumes from the checkpoint, and raising
+    // samples_per_pixel refines a finished render further.
+    const auto progressive = false;
+    const auto spp_per_pass = 16;
+    const std::string checkpoint_file = "render.ckpt";
+    const std::string preview_file = "preview.png";
+
+    // Adaptive sampling: once a pixel has min_spp samples, stop sampling it as soon as the error estimated from the
+    // running variance of its samples drops below adaptive_threshold. samples_per_pixel is then the maximum.
+    const auto adaptive = false;
+    const std::uint64_t min_spp = 32;
+    const std::uint64_t adaptive_batch = 16;
+    const auto adaptive_threshold = 0.005;
+
+    // Wavefront mode traces all the samples a tile needs in batches of wavefront_batch paths, one bounce at a time
+    // (see wavefront.h), instead of one path at a time. Both produce identical images.
+    const auto wavefront = false;
+    const std::size_t wavefront_batch = 1 << 16;
+
+    // Next-event estimation: at each diffuse hit, sample a point on one of the scene's lights and add the light it
+    // sends along an unblocked shadow ray (see lights.h). This finds small lights with far fewer samples.
+    const auto next_event = true;
+
+    // Multiple importance sampling: weight the light samples of next-event estimation against the bounces that hit
+    // the same lights, with the power heuristic. This handles glossy surfaces and large lights close by.
+    const auto multiple_importance = true;
+
+    // How the samples of each pixel are spread over the pixel, the lens, the shutter interval and the bounces of the
+    // paths: independent, stratified, halton or sobol (see sampler.h). sobol does best with a power of two samples.
+    // stratified takes its samples in rounds of sampling_round, each stratified on its own. Samples do not depend on
+    // samples_per_pixel, so a progressive render can raise it and resume; a checkpoint made with another sampling or
+    // round is not resumed.
+    const auto sampling = sampler_kind::sobol;
+    const auto sampling_round = 64;
+
+    // Intersect the camera rays for each pixel in SIMD packets of ray_packet::size samples (see packet.h). Packets
+    // fall back to one ray at a time wherever they stop being coherent, and produce identical images.
+    const auto packets = true;
+
+    // Instead of rendering, write statistics on the quality of the scene's BVHs to bvh_report_file as JSON (see
+    // bvh_stats.h), tracing one camera ray per pixel through them.
+    const auto bvh_report = false;
+    const std::string bvh_report_file = "bvh.json";
 
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+    // World
+    const auto config = select_scene(0);
+    const auto &world = config.world;
+    const auto &background = config.background;
+    const auto image_width = config.image_width;
+    const auto image_height = config.image_height();
+    // Unsigned, like the sample counts of the checkpoint and of pixel_stats that it is compared with.
+    const auto samples_per_pixel = static_cast<std::uint64_t>(config.samples_per_pixel);
 
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
+    const auto lights = next_event && !config.lights.empty() ? &config.lights : nullptr;
 
-    return emitted + attenuation * ray_color(scattered, background, world, depth - 1);
-}
-
-[[nodiscard]] auto random_scene() noexcept {
-    hittable_list world;
-
-    const auto checker = make_shared<checker_texture>(
-            color{0.2, 0.3, 0.1},
-            color{0.9, 0.9, 0.9}
-            );
-    const auto ground_material = make_shared<lambertian>(checker);
-    world.add(make_shared<sphere>(point3{0, -1000, 0}, 1000, ground_material));
-
-    for (auto a = -11; a < 11; ++a) {
-        for (auto b = -11; b < 11; ++b) {
-            const point3 center{a + 0.9 * random_double(), 0.2, b + 0.9 * random_double()};
-
-            if ((center - point3{4, 0.2, 0}).length() > 0.9) {
-                const auto choose_mat = random_double();
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // Diffuse.
-                    const auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    const auto center2 = center + vec3{0, random_double(0, 0.5), 0};
-                    world.add(make_shared<moving_sphere>(center, center2,
-                                                         0.0, 1.0, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // Metal
-                    const auto albedo = color::random(0.5, 1);
-                    const auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // Glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
+    // Camera
+    const auto cam = config.make_camera();
+    const sampler pixel_sampler{sampling, sampling_round, seed};
+
+    if (bvh_report) {
+        std::vector<ray> rays;
+        for (auto j = 0; j < image_height; ++j)
+            for (auto i = 0; i < image_width; ++i) {
+                auto gen = rng::for_sample(static_cast<std::uint64_t>(j) * image_width + i, 0, seed);
+                rays.emplace_back(cam.get_ray((i + 0.5) / (image_width - 1), (j + 0.5) / (image_height - 1), gen));
             }
+
+        std::ofstream out{bvh_report_file};
+        if (!write_bvh_report(out, config.name, world, rays))
+            return 1;
+        out << '\n';
+        if (!out) {
+            std::cerr << "ERROR: could not write " << bvh_report_file << ".\n";
+            return 1;
         }
+        std::cerr << "Wrote " << bvh_report_file << ".\n";
+        return 0;
     }
 
-    const auto material1 = make_shared<dielectric>(1.5);
-    const auto material2 = make_shared<lambertian>(color{0.4, 0.2, 0.1});
-    const auto material3 = make_shared<metal>(color{0.7, 0.6, 0.5}, 0.0);
-
-    world.add(make_shared<sphere>(point3{0, 1, 0}, 1.0, material1));
-    world.add(make_shared<sphere>(point3{-4, 1, 0}, 1.0, material2));
-    world.add(make_shared<sphere>(point3{4, 1, 0}, 1.0, material3));
-    return hittable_list(make_shared<bvh_node>(world, 0.0, 1.0));
-}
-
-hittable_list two_spheres() {
-    hittable_list objects;
-
-    const auto texture = make_shared<checker_texture>(
-            color{0.2, 0.3, 0.1},
-            color(0.9, 0.9, 0.9)
-    );
-    const auto material = make_shared<lambertian>(texture);
-    objects.add(make_shared<sphere>(point3{0, -10, 0}, 10, material));
-    objects.add(make_shared<sphere>(point3{0,  10, 0}, 10, material));
-
-    return hittable_list(make_shared<bvh_node>(objects));
-}
-
-hittable_list two_perlin_spheres() {
-    hittable_list objects;
-
-    const auto texture = make_shared<noise_texture>(4);
-    const auto material = make_shared<lambertian>(texture);
-    objects.add(make_shared<sphere>(point3{0, -1000, 0}, 1000, material));
-    objects.add(make_shared<sphere>(point3{0, 2, 0}, 2, material));
-
-    return hittable_list(make_shared<bvh_node>(objects));
-}
-
-hittable_list earth() {
-    const auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    const auto earth_material = make_shared<lambertian>(earth_texture);
-    const auto globe = make_shared<sphere>(point3{0, 0, 0}, 2, earth_material);
-    return hittable_list{globe};
-}
-
-hittable_list simple_light() {
-    hittable_list objects;
-
-    const auto texture = make_shared<noise_texture>(4);
-    const auto material = make_shared<lambertian>(texture);
-    objects.add(make_shared<sphere>(point3{0, -1000, 0}, 1000, material));
-    objects.add(make_shared<sphere>(point3{0, 2, 0}, 2, material));
-
-    const auto difflight = make_shared<diffuse_light>(color{4, 4, 4});
-    objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
-    objects.add(make_shared<sphere>(point3{0, 7, 0}, 2, difflight));
-
-    return hittable_list(make_shared<bvh_node>(objects));
-}
-
-hittable_list cornell_box() {
-    hittable_list objects;
-
-    const auto red   = make_shared<lambertian>(color{.65, .05, .05});
-    const auto white = make_shared<lambertian>(color{.73, .73, .73});
-    const auto green = make_shared<lambertian>(color{.12, .45, .15});
-    const auto light = make_shared<diffuse_light>(color{15, 15, 15});
-
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-    shared_ptr<hittable> box1 = make_shared<box>(point3{0, 0, 0}, point3{165, 330, 165}, white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3{265, 0, 295});
-    objects.add(box1);
-
-    shared_ptr<hittable> box2 = make_shared<box>(point3{0, 0, 0}, point3{165, 165, 165}, white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3{130, 0, 65});
-    objects.add(box2);
-
-    return hittable_list(make_shared<bvh_node>(objects));
-}
-
-hittable_list cornell_smoke() {
-    hittable_list objects;
-
-    const auto red   = make_shared<lambertian>(color{.65, .05, .05});
-    const auto white = make_shared<lambertian>(color{.73, .73, .73});
-    const auto green = make_shared<lambertian>(color{.12, .45, .15});
-    const auto light = make_shared<diffuse_light>(color{7, 7, 7});
-
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-    shared_ptr<hittable> box1 = make_shared<box>(point3{0, 0, 0}, point3{165, 330, 165}, white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3{265, 0, 295});
-    objects.add(make_shared<constant_medium>(box1, 0.01, BLACK));
-
-    shared_ptr<hittable> box2 = make_shared<box>(point3{0, 0, 0}, point3{165, 165, 165}, white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3{130, 0, 65});
-    objects.add(make_shared<constant_medium>(box2, 0.01, WHITE));
-
-    return hittable_list(make_shared<bvh_node>(objects));
-}
-
-hittable_list final_scene() {
-    hittable_list boxes1;
-    const auto ground = make_shared<lambertian>(color{0.48, 0.83, 0.53});
-
-    const auto boxes_per_side = 20;
-    for (auto i = 0; i < boxes_per_side; ++i)
-        for (auto j = 0; j < boxes_per_side; ++j) {
-            constexpr auto w = 100.0;
-
-            const auto x0 = -1000.0 + i * w;
-            constexpr auto y0 = 0.0;
-            const auto z0 = -1000.0 + j * w;
-
-            const auto x1 = x0 + w;
-            const auto y1 = random_double(1, 101);
-            const auto z1 = z0 + w;
-
-            boxes1.add(make_shared<box>(point3{x0, y0, z0}, point3{x1, y1, z1}, ground));
+    // The samples still to be taken in a tile: pixel k of the tile is brought up to targets[k] samples.
+    const auto sample_tile = [&](const tile &t,
+                                 const std::vector<std::uint64_t> &targets,
+                                 std::vector<color> &pixel_sums,
+                                 std::vector<pixel_stats> &stats,
+                                 path_stats &paths) {
+        const auto tile_width = t.x1 - t.x0;
+
+        // Each sample has its own stream and sample point, so the result does not depend on how the samples are split
+        // across calls.
+        const auto camera_ray = [&](std::size_t k, std::uint64_t s, rng &gen, sample_point &point) {
+            const auto i = t.x0 + static_cast<int>(k) % tile_width;
+            const auto j = t.y0 + static_cast<int>(k) / tile_width;
+            const auto pixel = static_cast<std::uint64_t>(j) * image_width + i;
+            gen = rng::for_sample(pixel, s, seed);
+            point = pixel_sampler.start(pixel, s);
+            const auto jitter = point.get_2d(gen);
+            const auto u = (i + jitter[0]) / (image_width - 1);
+            const auto v = (j + jitter[1]) / (image_height - 1);
+            const auto lens = point.get_2d(gen);
+            return cam.get_ray(u, v, lens, point.get_1d(gen));
+        };
+
+        const auto add_sample = [&](std::size_t k, const color &sample) {
+            pixel_sums[k] += sample;
+            stats[k].add(sample);
+        };
+
+        if (!wavefront && !packets) {
+            rng gen{0};
+            sample_point point;
+            for (std::size_t k = 0; k < targets.size(); ++k)
+                for (auto s = stats[k].count; s < targets[k]; ++s) {
+                    const auto r = camera_ray(k, s, gen, point);
+                    add_sample(k, trace_path(r, background, world, limits, gen, paths, lights, multiple_importance,
+                                             &point));
+                }
+            return;
         }
 
-    hittable_list objects;
-    objects.add(make_shared<bvh_node>(boxes1, 0, 1));
-
-    const auto light = make_shared<diffuse_light>(color{7, 7, 7});
-    objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
-
-    const auto center1 = point3{400, 400, 200};
-    const auto center2 = center1 + vec3{30, 0, 0};
-    const auto moving_sphere_material = make_shared<lambertian>(color{0.7, 0.3, 0.1});
-    objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
-
-    const auto dielec = make_shared<dielectric>(1.5);
-    objects.add(make_shared<sphere>(point3{260, 150, 45}, 50, dielec));
-    objects.add(make_shared<sphere>(point3{0, 150, 145}, 50, make_shared<metal>(color{0.8, 0.8, 0.9}, 1.0)));
-
-    const auto boundary1 = make_shared<sphere>(point3{360, 150, 145}, 70, dielec);
-    objects.add(boundary1);
-    objects.add(make_shared<constant_medium>(boundary1, 0.2, color{0.2, 0.4, 0.9}));
-
-    const auto boundary2 = make_shared<sphere>(point3{0, 0, 0}, 5000, dielec);
-    objects.add(make_shared<constant_medium>(boundary2, 1e-4, WHITE));
-
-    const auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    objects.add(make_shared<sphere>(point3{400, 200, 400}, 100, emat));
-
-    const auto pertext = make_shared<noise_texture>(0.1);
-    objects.add(make_shared<sphere>(point3{220, 280, 300}, 80, make_shared<lambertian>(pertext)));
-
-    hittable_list boxes2;
-    const auto white = make_shared<lambertian>(color{0.73, 0.73, 0.73});
-    constexpr auto ns = 1000;
-    for (auto j = 0; j < ns; ++j)
-        boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
-
-    objects.add(make_shared<translate>(
-            make_shared<rotate_y>(
-                    make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-                    vec3{-100, 270, 395}
-            )
-    );
-
-//    return objects;
-    return hittable_list(make_shared<bvh_node>(objects));
-}
-
-int main() {
-    std::mutex mtx;
-
-    auto aspect_ratio = 16.0 / 9.0;
-    auto image_width = 1000;
-//    const auto image_width = 400;
-    auto samples_per_pixel = 500;
-    const auto max_depth = 50;
-
-    // World
-    hittable_list world;
-    point3 lookfrom{13, 2, 3};
-    point3 lookat{0, 0, 0};
-    auto vfov = 20.0; // 40.0
-    auto aperture = 0.0;
-    color background{0.70, 0.80, 1.00}; // BLACK
-
-    switch (0) {
-        case 1:
-            world = random_scene();
-            aperture = 0.1;
-            break;
-
-        case 2:
-            world = two_spheres();
-            break;
-
-        case 3:
-            world = two_perlin_spheres();
-            break;
-
-        case 4:
-            world = earth();
-            break;
-
-        case 5:
-            world = simple_light();
-            samples_per_pixel = 400;
-            background = BLACK;
-            lookfrom = point3{26, 3, 6};
-            lookat = point3{0, 2, 0};
-            break;
-
-        case 6:
-            world = cornell_box();
-            aspect_ratio = 1.0;
-            image_width = 600;
-            samples_per_pixel = 200;
-            background = BLACK;
-            lookfrom = point3{278, 278, -800};
-            lookat = point3{278, 278, 0};
-            vfov = 40.0;
-            break;
-
-        case 7:
-            world = cornell_smoke();
-            aspect_ratio = 1.0;
-            image_width = 600;
-            samples_per_pixel = 200;
-            lookfrom = point3{278, 278, -800};
-            lookat = point3{278, 278, 0};
-            vfov = 40.0;
-            break;
-
-        default:
-        case 8:
-            world = final_scene();
-            aspect_ratio = 1.0;
-            image_width = 800;
-            samples_per_pixel = 10000;
-            background = BLACK;
-            lookfrom = point3{478, 278, -600};
-            lookat = point3{278, 278, 0};
-            vfov = 40.0;
-            break;
-    }
+        if (!wavefront) {
+            // The samples of one pixel are coherent, so their first hits are found a packet at a time.
+            std::vector<rng> gens(ray_packet::size, rng{0});
+            std::vector<sample_point> points(ray_packet::size);
+            std::array<hit_record, ray_packet::size> recs;
+            ray_packet packet;
+            for (std::size_t k = 0; k < targets.size(); ++k)
+                for (auto s = stats[k].count; s < targets[k]; s += ray_packet::size) {
+                    const auto n = static_cast<int>(std::min<std::uint64_t>(ray_packet::size, targets[k] - s));
+                    packet.clear();
+                    for (auto l = 0; l < n; ++l)
+                        packet.add(camera_ray(k, s + l, gens[l], points[l]), gens[l], recs[l], infinity);
+
+                    const auto hit = world.hit_packet(packet, packet.lanes(), ray_t_min);
+                    for (auto l = 0; l < n; ++l)
+                        add_sample(k, continue_path(packet.rays[l], hit & (1u << l), recs[l],
+                                                    background, world, limits, gens[l], paths, lights,
+                                                    multiple_importance, &points[l]));
+                }
+            return;
+        }
 
-    const auto image_height = static_cast<int>(image_width / aspect_ratio);
+        // Batches are filled and drained in (pixel, sample) order, so every pixel still sees its samples in order.
+        wavefront_tracer tracer{world, background, limits, lights, multiple_importance};
+        std::vector<wavefront_path> batch;
+        std::vector<std::size_t> owner;
+        const auto flush = [&] {
+            tracer.trace(batch, paths);
+            for (std::size_t p = 0; p < batch.size(); ++p)
+                add_sample(owner[p], batch[p].radiance);
+            batch.clear();
+            owner.clear();
+        };
+
+        for (std::size_t k = 0; k < targets.size(); ++k)
+            for (auto s = stats[k].count; s < targets[k]; ++s) {
+                rng gen{0};
+                sample_point point;
+                const auto r = camera_ray(k, s, gen, point);
+                batch.push_back(wavefront_path{r, gen, point});
+                owner.emplace_back(k);
+                if (batch.size() == wavefront_batch)
+                    flush();
+            }
+        if (!batch.empty())
+            flush();
+    };
+
+    std::mutex paths_mtx;
+    path_stats paths;
+    const auto record_paths = [&](const path_stats &tile_paths) {
+        std::lock_guard<std::mutex> lock(paths_mtx);
+        paths += tile_paths;
+    };
+
+    const auto converged = [&](const pixel_stats &stats) {
+        return adaptive && stats.count >= min_spp && stats.display_error() < adaptive_threshold;
+    };
+
+    const auto report_savings = [&](const auto &pixel_samples) {
+        if (!adaptive)
+            return;
+        std::uint64_t taken = 0;
+        for (auto j = 0; j < image_height; ++j)
+            for (auto i = 0; i < image_width; ++i)
+                taken += pixel_samples(i, j);
+        const auto budget = static_cast<std::uint64_t>(image_width) * image_height * samples_per_pixel;
+        std::cerr << "\nAdaptive sampling took " << taken << " of " << budget << " samples, saving "
+                  << budget - taken << " (" << 100.0 * static_cast<double>(budget - taken) / budget << "%).";
+    };
+
+    const auto tiles = make_tiles(image_width, image_height, tile_size);
+    tile_scheduler scheduler;
+    const auto report = [](std::size_t remaining) {
+        std::cerr << "\rTiles remaining: " << remaining << ' ' << std::flush;
+    };
+
+    if (progressive) {
+        checkpoint ckpt{checkpoint_file, image_width, image_height, seed, config.identity(), pixel_sampler};
+        if (!ckpt.is_open())
+            return 1;
+        if (ckpt.resumed())
+            std::cerr << "Resuming " << checkpoint_file << " at " << ckpt.samples() << " samples per pixel.\n";
+
+        const auto pixel_sum = [&](int i, int j) { return ckpt.sum(i, j); };
+        const auto pixel_samples = [&](int i, int j) { return ckpt.count(i, j); };
+
+        while (ckpt.samples() < samples_per_pixel) {
+            const auto target = std::min<std::uint64_t>(samples_per_pixel, ckpt.samples() + spp_per_pass);
+            scheduler.run(tiles, [&](const tile &t) {
+                std::vector<color> pixel_sums;
+                std::vector<pixel_stats> stats;
+                std::vector<std::uint64_t> targets;
+                for (auto j = t.y0; j < t.y1; ++j)
+                    for (auto i = t.x0; i < t.x1; ++i) {
+                        pixel_sums.emplace_back(ckpt.sum(i, j));
+                        stats.emplace_back(ckpt.stats(i, j));
+                        targets.emplace_back(converged(stats.back()) ? stats.back().count : target);
+                    }
+
+                path_stats tile_paths;
+                sample_tile(t, targets, pixel_sums, stats, tile_paths);
+                record_paths(tile_paths);
+
+                for (std::size_t k = 0; k < targets.size(); ++k)
+                    ckpt.store(t.x0 + static_cast<int>(k) % (t.x1 - t.x0),
+                               t.y0 + static_cast<int>(k) / (t.x1 - t.x0),
+                               pixel_sums[k], stats[k]);
+            }, report);
+            ckpt.commit(target);
+
+            write_image(preview_file, resolve(image_width, image_height, pixel_sum, pixel_samples));
+            std::cerr << "\rPass " << ckpt.passes() << " complete: " << target << " samples per pixel.\n";
+        }
 
-    // Camera
-    const vec3 vup{0, 1, 0};
-    const auto dist_to_focus = 10.0;
-    camera cam(lookfrom, lookat, vup, vfov,
-               aspect_ratio, aperture, dist_to_focus,
-               0.0, 1.0);
-
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    for (auto j = image_height - 1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        std::vector<color> line(image_width);
-        #pragma omp parallel for schedule(dynamic) default(none) shared(background, mtx, std::cout, j, world, cam, image_width, image_height, max_depth, samples_per_pixel, line)
-        for (auto i = 0; i < image_width; ++i) {
-            color pixel_color{0, 0, 0};
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                const auto u = (i + random_double()) / (image_width - 1);
-                const auto v = (j + random_double()) / (image_height - 1);
-                const auto r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, max_depth);
+        if (!write_image(output_file, resolve(image_width, image_height, pixel_sum, pixel_samples)))
+            return 1;
+        report_savings(pixel_samples);
+    } else {
+        // Render into a full-frame buffer, one tile per task. Each tile owns its pixels, so no locking is needed.
+        framebuffer image{image_width, image_height};
+        scheduler.run(tiles, [&](const tile &t) {
+            const auto tile_pixels = static_cast<std::size_t>(t.x1 - t.x0) * (t.y1 - t.y0);
+            std::vector<color> pixel_sums(tile_pixels);
+            std::vector<pixel_stats> stats(tile_pixels);
+            std::vector<std::uint64_t> targets(tile_pixels, adaptive ? min_spp : samples_per_pixel);
+
+            path_stats tile_paths;
+            sample_tile(t, targets, pixel_sums, stats, tile_paths);
+
+            // Keep refining the pixels that have not converged, a batch of samples at a time.
+            auto refining = adaptive;
+            while (refining) {
+                refining = false;
+                for (std::size_t k = 0; k < tile_pixels; ++k)
+                    if (stats[k].count < samples_per_pixel && !converged(stats[k])) {
+                        targets[k] = std::min(samples_per_pixel, stats[k].count + adaptive_batch);
+                        refining = true;
+                    }
+                if (refining)
+                    sample_tile(t, targets, pixel_sums, stats, tile_paths);
             }
-            {
-                std::lock_guard<std::mutex> lock(mtx);
-                line[i] = pixel_color;
+            record_paths(tile_paths);
+
+            for (std::size_t k = 0; k < tile_pixels; ++k) {
+                const auto i = t.x0 + static_cast<int>(k) % (t.x1 - t.x0);
+                const auto j = t.y0 + static_cast<int>(k) / (t.x1 - t.x0);
+                image(i, j) = pixel_sums[k];
+                image.samples(i, j) = static_cast<std::uint32_t>(stats[k].count);
             }
-        }
+        }, report);
 
-        for (const auto pixel_color: line)
-            write_color(std::cout, pixel_color, samples_per_pixel);
+        const auto pixel_samples = [&](int i, int j) { return image.samples(i, j); };
+        const auto img = resolve(image_width, image_height, [&](int i, int j) { return image(i, j); }, pixel_samples);
+        if (!write_image(output_file, img))
+            return 1;
+        report_savings(pixel_samples);
     }
 
+    std::cerr << "\nAverage path length: " << paths.average_length() << " rays.";
     std::cerr << "\nDone.\n";
 }
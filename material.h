@@ -9,19 +9,49 @@
 
 #include "ray.h"
 #include "hittable.h"
+#include "onb.h"
+#include "sampling.h"
 #include "texture.h"
 
+// The kind of bounce a material scatters into, so that path depth can be limited separately for each.
+enum class bounce_type {
+    diffuse,
+    glossy,
+    transmission,
+    volume
+};
+
 class material {
 public:
     [[nodiscard]] virtual bool scatter(
             const ray &r_in,
             const hit_record &rec,
             color &attenuation,
-            ray &scattered) const noexcept = 0;
+            ray &scattered,
+            rng &gen) const noexcept = 0;
 
     [[nodiscard]] virtual color emitted(double u, double v, point3 &p) const noexcept {
         return BLACK;
     }
+
+    [[nodiscard]] virtual bounce_type bounce() const noexcept {
+        return bounce_type::diffuse;
+    }
+
+    // The density, per unit solid angle, with which scatter picks the direction of scattered. The attenuation times
+    // this density is the BSDF times the cosine, which integrators that sample lights need for the directions they
+    // pick themselves (see lights.h).
+    [[nodiscard]] virtual double scattering_pdf(const ray &r_in,
+                                                const hit_record &rec,
+                                                const ray &scattered) const noexcept {
+        return 0;
+    }
+
+    // Whether scatter picks from a delta (specular) lobe, whose density cannot be evaluated, so that integrators do
+    // not sample lights at its hits. Materials that do not give their density count as delta.
+    [[nodiscard]] virtual bool delta() const noexcept {
+        return true;
+    }
 };
 
 class lambertian : public material {
@@ -35,17 +65,32 @@ public:
             const ray &r_in,
             const hit_record &rec,
             color &attenuation,
-            ray &scattered) const noexcept override {
-        auto scatter_direction = rec.normal + random_unit_vector();
-
-        // Catch degenerate scatter direction.
-        if (scatter_direction.near_zero())
-            scatter_direction = rec.normal;
-
-        scattered = ray{rec.p, scatter_direction, r_in.time()};
+            ray &scattered,
+            rng &gen) const noexcept override {
+        scattered = scatter_ray(r_in, rec, random_2d(gen));
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
+
+    [[nodiscard]] double scattering_pdf(const ray &r_in,
+                                        const hit_record &rec,
+                                        const ray &scattered) const noexcept override {
+        return pdf(rec, scattered.direction());
+    }
+
+    [[nodiscard]] bool delta() const noexcept override {
+        return false;
+    }
+
+    // The direction of the bounce for the sample u, which does not depend on the albedo. The material table (see
+    // material_table.h) shares it, and draws u from the path's sampler.
+    [[nodiscard]] static ray scatter_ray(const ray &r_in, const hit_record &rec, const sample_2d &u) noexcept {
+        return ray{rec.p, onb::from_unit(rec.normal).local(cosine_hemisphere(u)), r_in.time()};
+    }
+
+    [[nodiscard]] static double pdf(const hit_record &rec, const vec3 &direction) noexcept {
+        return cosine_hemisphere_pdf(rec.normal.dot(direction.unit_vector()));
+    }
 };
 
 class metal : public material {
@@ -59,12 +104,57 @@ public:
             const ray &r_in,
             const hit_record &rec,
             color &attenuation,
-            ray &scattered) const noexcept override {
-        const auto reflected = reflect(r_in.direction().unit_vector(), rec.normal);
-        scattered = ray{rec.p, reflected + fuzz * random_in_unit_sphere(), r_in.time()};
+            ray &scattered,
+            rng &gen) const noexcept override {
         attenuation = albedo;
+        return scatter_ray(r_in, rec, fuzz, random_3d(gen), scattered);
+    }
+
+    [[nodiscard]] double scattering_pdf(const ray &r_in,
+                                        const hit_record &rec,
+                                        const ray &scattered) const noexcept override {
+        return pdf(r_in, rec, fuzz, scattered.direction());
+    }
+
+    [[nodiscard]] bool delta() const noexcept override {
+        return fuzz == 0;
+    }
+
+    [[nodiscard]] static bool scatter_ray(const ray &r_in,
+                                          const hit_record &rec,
+                                          double fuzz,
+                                          const sample_3d &u,
+                                          ray &scattered) noexcept {
+        const auto reflected = reflect(r_in.direction().unit_vector(), rec.normal);
+        scattered = ray{rec.p, reflected + fuzz * uniform_ball(u), r_in.time()};
         return scattered.direction().dot(rec.normal) > 0;
     }
+
+    // The fuzzed reflection is uniform in the ball of radius fuzz around the unit reflection R. Along a direction w, it
+    // lies in the ball between the roots t0 < t1 of |t w - R| = fuzz, so the density of w is the volume of that cone
+    // segment, (t1^3 - t0^3) / 3, over the volume of the ball. Directions into the surface are absorbed, but are
+    // still picked with this density.
+    [[nodiscard]] static double pdf(const ray &r_in,
+                                    const hit_record &rec,
+                                    double fuzz,
+                                    const vec3 &direction) noexcept {
+        if (fuzz <= 0)
+            return 0;
+        const auto reflected = reflect(r_in.direction().unit_vector(), rec.normal);
+        const auto b = direction.unit_vector().dot(reflected);
+        const auto discriminant = b * b - reflected.length_squared() + fuzz * fuzz;
+        if (discriminant <= 0)
+            return 0;
+        const auto t1 = b + std::sqrt(discriminant);
+        if (t1 <= 0)
+            return 0;
+        const auto t0 = std::fmax(b - std::sqrt(discriminant), 0.0);
+        return (t1 * t1 * t1 - t0 * t0 * t0) / (4 * pi * fuzz * fuzz * fuzz);
+    }
+
+    [[nodiscard]] bounce_type bounce() const noexcept override {
+        return bounce_type::glossy;
+    }
 };
 
 class dielectric : public material {
@@ -78,23 +168,39 @@ public:
             const ray &r_in,
             const hit_record &rec,
             color &attenuation,
-            ray &scattered) const noexcept override {
+            ray &scattered,
+            rng &gen) const noexcept override {
         attenuation = WHITE;
+        scattered = scatter_ray(r_in, rec, ir, [&gen] { return random_double(gen); });
+        return true;
+    }
+
+    [[nodiscard]] bool delta() const noexcept override {
+        return true;
+    }
+
+    // Reflects if it must, or if u() falls below the reflectance, and refracts otherwise. u is only called when the ray
+    // can refract.
+    template<typename U>
+    [[nodiscard]] static ray scatter_ray(const ray &r_in, const hit_record &rec, double ir, U &&u) noexcept {
         const auto refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
 
         const auto unit_direction = r_in.direction().unit_vector();
-        const auto cos_theta = std::min((-unit_direction).dot(rec.normal), 1.0);
+        const auto cos_theta = std::fmin((-unit_direction).dot(rec.normal), 1.0);
         const auto sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
 
         const auto cannot_refract = refraction_ratio * sin_theta > 1.0;
         vec3 direction;
-        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > random_double())
+        if (cannot_refract || reflectance(cos_theta, refraction_ratio) > u())
             direction = reflect(unit_direction, rec.normal);
         else
             direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-        scattered = ray{rec.p, direction, r_in.time()};
-        return true;
+        return ray{rec.p, direction, r_in.time()};
+    }
+
+    [[nodiscard]] bounce_type bounce() const noexcept override {
+        return bounce_type::transmission;
     }
 
 private:
@@ -117,7 +223,8 @@ public:
             const ray &r_in,
             const hit_record &rec,
             color &attenuation,
-            ray &scattered) const noexcept override {
+            ray &scattered,
+            rng &gen) const noexcept override {
         return false;
     }
 
@@ -137,9 +244,32 @@ public:
             const ray &r_in,
             const hit_record &rec,
             color &attenuation,
-            ray &scattered) const noexcept override {
-        scattered = ray(rec.p, random_in_unit_sphere(), r_in.time());
+            ray &scattered,
+            rng &gen) const noexcept override {
+        scattered = scatter_ray(r_in, rec, random_2d(gen));
         attenuation = albedo->value(rec.u, rec.v, rec.p);
         return true;
     }
+
+    [[nodiscard]] double scattering_pdf(const ray &r_in,
+                                        const hit_record &rec,
+                                        const ray &scattered) const noexcept override {
+        return pdf();
+    }
+
+    [[nodiscard]] bool delta() const noexcept override {
+        return false;
+    }
+
+    [[nodiscard]] static ray scatter_ray(const ray &r_in, const hit_record &rec, const sample_2d &u) noexcept {
+        return ray{rec.p, uniform_sphere(u), r_in.time()};
+    }
+
+    [[nodiscard]] static double pdf() noexcept {
+        return uniform_sphere_pdf();
+    }
+
+    [[nodiscard]] bounce_type bounce() const noexcept override {
+        return bounce_type::volume;
+    }
 };
@@ -0,0 +1,282 @@
+/**
+ * material_table.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "material.h"
+#include "sampler.h"
+#include "texture.h"
+
+// The materials the renderer ships with, flattened into a record tagged with its kind and shaded by a switch on the
+// kind instead of by virtual calls. Solid colors are held in the record, so the common lambertian does not call into
+// a texture either. Any other material is kept behind its pointer and shaded through its virtual functions.
+enum class material_kind : std::uint8_t {
+    lambertian,
+    metal,
+    dielectric,
+    diffuse_light,
+    isotropic,
+    polymorphic,
+};
+
+struct material_record final {
+    material_kind kind = material_kind::polymorphic;
+    bounce_type bounce = bounce_type::diffuse;
+
+    // Whether emitted can return anything but black. Shading skips emission for the records that do not emit.
+    bool emits = false;
+
+    // Whether scatter picks from a delta lobe (see material::delta).
+    bool delta = true;
+
+    // The albedo of lambertian, metal and isotropic, or the emission of diffuse_light, unless tex is set.
+    color albedo{0, 0, 0};
+    const texture *tex = nullptr;
+
+    // The fuzz of metal, or the index of refraction of dielectric.
+    double parameter = 0;
+
+    // The material of a polymorphic record.
+    const material *object = nullptr;
+
+    [[nodiscard]] static material_record lambertian(const color &albedo) noexcept {
+        return {material_kind::lambertian, bounce_type::diffuse, false, false, albedo};
+    }
+
+    [[nodiscard]] static material_record metal(const color &albedo, double fuzz) noexcept {
+        return {material_kind::metal, bounce_type::glossy, false, fuzz == 0, albedo, nullptr, fuzz};
+    }
+
+    [[nodiscard]] static material_record dielectric(double index_of_refraction) noexcept {
+        return {material_kind::dielectric, bounce_type::transmission, false, true, WHITE, nullptr,
+                index_of_refraction};
+    }
+
+    [[nodiscard]] static material_record diffuse_light(const color &emit) noexcept {
+        return {material_kind::diffuse_light, bounce_type::diffuse, true, true, emit};
+    }
+
+    [[nodiscard]] static material_record isotropic(const color &albedo) noexcept {
+        return {material_kind::isotropic, bounce_type::volume, false, false, albedo};
+    }
+
+    [[nodiscard]] bool operator==(const material_record &other) const noexcept {
+        return kind == other.kind && bounce == other.bounce && emits == other.emits && delta == other.delta
+               && albedo.x() == other.albedo.x() && albedo.y() == other.albedo.y() && albedo.z() == other.albedo.z()
+               && tex == other.tex && parameter == other.parameter && object == other.object;
+    }
+
+    [[nodiscard]] color emitted(double u, double v, point3 &p) const noexcept {
+        switch (kind) {
+            case material_kind::diffuse_light: return value(u, v, p);
+            case material_kind::polymorphic: return object->emitted(u, v, p);
+            default: return BLACK;
+        }
+    }
+
+    // The shipped kinds scatter by the samples u (see bounce_sample), and polymorphic materials draw from gen.
+    [[nodiscard]] bool scatter(const ray &r_in,
+                               const hit_record &rec,
+                               bounce_sample &u,
+                               color &attenuation,
+                               ray &scattered,
+                               rng &gen) const noexcept {
+        switch (kind) {
+            case material_kind::lambertian:
+                scattered = ::lambertian::scatter_ray(r_in, rec, u.get_2d());
+                attenuation = value(rec.u, rec.v, rec.p);
+                return true;
+            case material_kind::metal:
+                attenuation = albedo;
+                return ::metal::scatter_ray(r_in, rec, parameter, u.get_3d(), scattered);
+            case material_kind::dielectric:
+                attenuation = WHITE;
+                scattered = ::dielectric::scatter_ray(r_in, rec, parameter, [&u] { return u.get_1d(); });
+                return true;
+            case material_kind::diffuse_light:
+                return false;
+            case material_kind::isotropic:
+                scattered = ::isotropic::scatter_ray(r_in, rec, u.get_2d());
+                attenuation = value(rec.u, rec.v, rec.p);
+                return true;
+            default:
+                return object->scatter(r_in, rec, attenuation, scattered, gen);
+        }
+    }
+
+    // Whether the integrators sample the lights at hits on this material: those of the shipped kinds that do not
+    // scatter from a delta lobe. The scattering of polymorphic materials is not known.
+    [[nodiscard]] bool samples_lights() const noexcept {
+        return !delta && (kind == material_kind::lambertian || kind == material_kind::metal
+                          || kind == material_kind::isotropic);
+    }
+
+    // The density, per unit solid angle, with which scatter picks the direction (see material::scattering_pdf).
+    [[nodiscard]] double pdf(const ray &r_in, const hit_record &rec, const vec3 &direction) const noexcept {
+        switch (kind) {
+            case material_kind::lambertian: return ::lambertian::pdf(rec, direction);
+            case material_kind::metal: return ::metal::pdf(r_in, rec, parameter, direction);
+            case material_kind::isotropic: return ::isotropic::pdf();
+            case material_kind::polymorphic:
+                return object->scattering_pdf(r_in, rec, ray{rec.p, direction, r_in.time()});
+            default: return 0;
+        }
+    }
+
+    // For the materials that sample lights, the scattering back along r_in of light arriving at rec along direction:
+    // the BSDF times the cosine at a surface, and the phase function in a medium. Since scatter's attenuation is the
+    // ratio of this to the density with which it picks directions, this is the attenuation times the density.
+    [[nodiscard]] color scattering(const ray &r_in, const hit_record &rec, const vec3 &direction) const noexcept {
+        const auto density = pdf(r_in, rec, direction);
+        if (density <= 0)
+            return BLACK;
+        if (kind == material_kind::metal)
+            return direction.dot(rec.normal) > 0 ? albedo * density : BLACK;
+        return value(rec.u, rec.v, rec.p) * density;
+    }
+
+private:
+    [[nodiscard]] color value(double u, double v, const point3 &p) const noexcept {
+        return tex ? tex->value(u, v, p) : albedo;
+    }
+};
+
+// The materials of the scenes in one array, indexed by the material_id that hittables hand to their hit records.
+// Materials are interned: every material with the same parameters, whether given as a record or as one of the
+// polymorphic classes, gets the same entry. The table holds on to the textures and polymorphic materials its records
+// point to.
+class material_table final {
+private:
+    struct record_hash final {
+        [[nodiscard]] std::size_t operator()(const material_record &m) const noexcept {
+            std::size_t h = static_cast<std::size_t>(m.kind);
+            const auto mix = [&h](std::size_t x) { h ^= x + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2); };
+            for (auto a = 0; a < 3; ++a)
+                mix(std::hash<double>{}(m.albedo[a]));
+            mix(std::hash<double>{}(m.parameter));
+            mix(std::hash<const void*>{}(m.tex));
+            mix(std::hash<const void*>{}(m.object));
+            return h;
+        }
+    };
+
+    std::vector<material_record> records;
+    std::unordered_map<material_record, material_id, record_hash> ids;
+    std::vector<std::shared_ptr<const void>> owned;
+
+    // The color of t if it is a solid_color, so that the record can hold it instead.
+    [[nodiscard]] static bool solid(const texture &t, color &c) noexcept {
+        if (typeid(t) != typeid(solid_color))
+            return false;
+        c = t.value(0, 0, point3{0, 0, 0});
+        return true;
+    }
+
+    // Intern m, holding on to owner if m is a new entry. An entry found again keeps the owner it was added with.
+    material_id add(const material_record &m, const std::shared_ptr<const void> &owner) {
+        const auto [it, added] = ids.try_emplace(m, static_cast<material_id>(records.size()));
+        if (added) {
+            records.emplace_back(m);
+            if (owner)
+                owned.emplace_back(owner);
+        }
+        return it->second;
+    }
+
+    // Intern m with the texture t, or with its color if t is a solid_color.
+    material_id intern(material_record m, const std::shared_ptr<texture> &t) {
+        if (solid(*t, m.albedo))
+            return intern(m);
+        m.tex = t.get();
+        return add(m, t);
+    }
+
+public:
+    [[nodiscard]] const material_record &operator[](material_id id) const noexcept {
+        return records[id];
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept {
+        return records.size();
+    }
+
+    material_id intern(const material_record &m) {
+        return add(m, nullptr);
+    }
+
+    // Only the exact classes of material.h are flattened: a subclass may override what they do.
+    material_id intern(const std::shared_ptr<material> &m) {
+        const auto &type = typeid(*m);
+        if (type == typeid(::lambertian))
+            return intern(material_record::lambertian(BLACK), static_cast<const ::lambertian&>(*m).albedo);
+        if (type == typeid(::metal)) {
+            const auto &metal = static_cast<const ::metal&>(*m);
+            return intern(material_record::metal(metal.albedo, metal.fuzz));
+        }
+        if (type == typeid(::dielectric))
+            return intern(material_record::dielectric(static_cast<const ::dielectric&>(*m).ir));
+        if (type == typeid(::diffuse_light))
+            return intern(material_record::diffuse_light(BLACK), static_cast<const ::diffuse_light&>(*m).emit);
+        if (type == typeid(::isotropic))
+            return intern(material_record::isotropic(BLACK), static_cast<const ::isotropic&>(*m).albedo);
+
+        // Nothing tells whether the class overrides emitted, so it is assumed to emit.
+        const material_record record{material_kind::polymorphic, m->bounce(), true, m->delta(), BLACK, nullptr, 0,
+                                     m.get()};
+        return add(record, m);
+    }
+
+    // Drop every entry, and release the textures and materials they point to.
+    void clear() noexcept {
+        records.clear();
+        ids.clear();
+        owned.clear();
+    }
+};
+
+// The table that the hittables of every scene intern their materials into, and that the integrators shade from.
+// Scenes are built on one thread before rendering, and the table is only read while rendering.
+inline material_table scene_materials;
+
+// Gives the scenes built while it lives a scene_materials of their own, and on leaving releases that table, with the
+// textures and materials it holds, and puts back the one there was before. The scenes must not outlive it.
+class material_scope final {
+private:
+    material_table outer;
+
+public:
+    material_scope() noexcept {
+        std::swap(scene_materials, outer);
+    }
+
+    material_scope(const material_scope&) = delete;
+    material_scope &operator=(const material_scope&) = delete;
+
+    ~material_scope() {
+        std::swap(scene_materials, outer);
+    }
+};
+
+// The material of a hittable, given either as an entry of scene_materials or as one of the polymorphic classes,
+// which is interned.
+struct material_ref final {
+    material_id id;
+
+    material_ref(material_id id) noexcept: id{id} {}
+
+    template<std::derived_from<material> M>
+    material_ref(const std::shared_ptr<M> &m): id{scene_materials.intern(std::shared_ptr<material>{m})} {}
+};
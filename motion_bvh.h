@@ -0,0 +1,193 @@
+/**
+ * motion_bvh.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+
+// A BVH for primitives that move during the shutter interval. Each node keeps its bounds at a number of evenly spaced
+// time keys over [time0, time1], and a ray is tested against the bounds interpolated to its own time, rather than
+// against the union over the whole interval, which for fast moving primitives is large and overlaps its neighbours.
+//
+// The interpolated bounds are conservative as long as the primitives move linearly between keys, as moving_sphere
+// does: the bounds of a node at a key are the union of those of its children, and interpolating a union contains the
+// union of the interpolations. Rays whose times fall outside [time0, time1] are tested against the union.
+class motion_bvh final : public hittable {
+public:
+    // The bounds of a node between two neighbouring keys: at a fraction f of the way, they are start + f * slope.
+    struct segment final {
+        aabb start;
+        aabb slope;
+    };
+
+    // The tree, whose boxes are the unions of the key bounds.
+    std::vector<linear_bvh::node> nodes;
+    std::vector<std::shared_ptr<hittable>> primitives;
+
+    // The bounds of node i from key k to key k + 1 are at segments[i * (keys - 1) + k].
+    std::vector<segment> segments;
+    const int keys;
+    const double time0;
+    const double time1;
+
+    // Refit the tree of topology at keys time keys (at least 2) over [time0, time1].
+    motion_bvh(const linear_bvh &topology, double time0, double time1, int keys = 4)
+    : nodes{topology.nodes}, primitives{topology.primitives}, keys{std::max(keys, 2)}, time0{time0}, time1{time1} {
+        std::vector<aabb> key_boxes(nodes.size() * this->keys);
+
+        // Children follow their parents, so walking backwards finishes the children first.
+        for (auto i = nodes.size(); i-- > 0;) {
+            auto &n = nodes[i];
+            for (auto k = 0; k < this->keys; ++k) {
+                const auto time = key_time(k);
+                auto &box = key_boxes[i * this->keys + k];
+                if (n.count > 0) {
+                    for (auto p = n.offset; p < n.offset + n.count; ++p) {
+                        aabb primitive_box;
+                        if (!primitives[p]->bounding_box(time, time, primitive_box))
+                            std::cerr << "No bounding box in motion_bvh constructor.\n";
+                        box = p == n.offset ? primitive_box : surrounding_box(box, primitive_box);
+                    }
+                } else {
+                    box = surrounding_box(key_boxes[(i + 1) * this->keys + k], key_boxes[n.offset * this->keys + k]);
+                }
+                n.box = k == 0 ? box : surrounding_box(n.box, box);
+            }
+        }
+
+        segments.reserve(nodes.size() * (this->keys - 1));
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+            for (auto k = 0; k + 1 < this->keys; ++k) {
+                const auto &b0 = key_boxes[i * this->keys + k];
+                const auto &b1 = key_boxes[i * this->keys + k + 1];
+                segments.emplace_back(segment{b0, aabb{b1.minimum - b0.minimum, b1.maximum - b0.maximum}});
+            }
+    }
+
+    [[nodiscard]] bool bounding_box(double _time0, double _time1, aabb &output_box) const noexcept override {
+        output_box = nodes.front().box;
+        return true;
+    }
+
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
+        return hit_impl(r, t_min, t_max, rec, gen);
+    }
+
+    // hit, counting the nodes it visits and the primitives it tests in stats.
+    [[nodiscard]] bool hit(const ray &r,
+                           double t_min,
+                           double t_max,
+                           hit_record &rec,
+                           rng &gen,
+                           linear_bvh::traversal_stats &stats) const noexcept {
+        ++stats.rays;
+        return hit_impl<true>(r, t_min, t_max, rec, gen, &stats);
+    }
+
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        hit_record unused;
+        return hit_impl<false, true>(r, t_min, t_max, unused, gen);
+    }
+
+private:
+    [[nodiscard]] double key_time(int k) const noexcept {
+        return time0 + (time1 - time0) * k / (keys - 1);
+    }
+
+    // As linear_bvh::hit_from.
+    template<bool Counted = false, bool AnyHit = false>
+    [[nodiscard]] bool hit_impl(const ray &r,
+                                double t_min,
+                                double t_max,
+                                hit_record &rec,
+                                rng &gen,
+                                linear_bvh::traversal_stats *stats = nullptr) const noexcept {
+        // The pair of keys around the ray's time, and how far it is between them. Every node interpolates with these.
+        const auto s = time1 > time0 ? (r.time() - time0) / (time1 - time0) * (keys - 1) : 0.0;
+        const auto in_range = s >= 0 && s <= keys - 1;
+        const auto key = in_range ? std::min(static_cast<int>(s), keys - 2) : 0;
+        const auto f = s - key;
+
+        // The slab test of aabb::hit, with the reciprocals of the direction taken once.
+        std::array<double, 3> inv_dir;
+        std::array<bool, 3> negative;
+        for (auto a = 0; a < 3; ++a) {
+            inv_dir[a] = 1.0 / r.direction()[a];
+            negative[a] = inv_dir[a] < 0;
+        }
+        const auto node_hit = [&](std::uint32_t index) {
+            // Out of range, the union box is the start of a segment that does not move.
+            const auto &start = in_range ? segments[index * (keys - 1) + key].start : nodes[index].box;
+            const auto &slope = segments[index * (keys - 1) + key].slope;
+            const auto g = in_range ? f : 0.0;
+            auto near = t_min;
+            auto far = t_max;
+            for (auto a = 0; a < 3; ++a) {
+                auto t0 = (start.minimum[a] + g * slope.minimum[a] - r.origin()[a]) * inv_dir[a];
+                auto t1 = (start.maximum[a] + g * slope.maximum[a] - r.origin()[a]) * inv_dir[a];
+                if (negative[a])
+                    std::swap(t0, t1);
+                near = t0 > near ? t0 : near;
+                far = t1 < far ? t1 : far;
+                if (far <= near)
+                    return false;
+            }
+            return true;
+        };
+
+        std::array<std::uint32_t, linear_bvh::max_depth> stack;
+        auto top = 0;
+        std::uint32_t index = 0;
+        auto hit_anything = false;
+
+        // As linear_bvh's traversal, with the boxes at the ray's time.
+        while (true) {
+            const auto &n = nodes[index];
+            if constexpr (Counted)
+                ++stats->node_visits;
+            if (node_hit(index)) {
+                if (n.count == 0) {
+                    if (negative[n.axis]) {
+                        stack[top++] = index + 1;
+                        index = n.offset;
+                    } else {
+                        stack[top++] = n.offset;
+                        index = index + 1;
+                    }
+                    continue;
+                }
+
+                if constexpr (Counted)
+                    stats->primitive_tests += n.count;
+                for (auto p = n.offset; p < n.offset + n.count; ++p) {
+                    if constexpr (AnyHit) {
+                        if (primitives[p]->occluded(r, t_min, t_max, gen))
+                            return true;
+                    } else if (primitives[p]->hit(r, t_min, t_max, rec, gen)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+            }
+
+            if (top == 0)
+                break;
+            index = stack[--top];
+        }
+
+        return hit_anything;
+    }
+};
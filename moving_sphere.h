@@ -7,69 +7,90 @@
 
 #include "rtweekend.h"
 #include "hittable.h"
+#include "material_table.h"
 
-class moving_sphere : public hittable {
+// A sphere moving from center0 at time0 to center1 at time1, intersected in T like basic_sphere.
+template<typename T>
+class basic_moving_sphere final : public hittable {
 public:
-    point3 center0, center1;
-    double time0, time1;
-    double radius;
-    shared_ptr<material> mat_ptr;
+    basic_vec3<T> center0, center1;
+    T time0, time1;
+    T radius;
+    material_id mat = 0;
 
-    moving_sphere() = default;
-    moving_sphere(point3 center0,
-                  point3 center1,
-                  double time0,
-                  double time1,
-                  double radius,
-                  shared_ptr<material> mat_ptr)
-                  : center0{center0}, center1{center1}, time0{time0}, time1{time1}, radius{radius}, mat_ptr{mat_ptr} {}
+    basic_moving_sphere() = default;
+    basic_moving_sphere(const point3 &center0,
+                        const point3 &center1,
+                        double time0,
+                        double time1,
+                        double radius,
+                        material_ref mat)
+                        : center0{center0}, center1{center1}, time0{static_cast<T>(time0)},
+                          time1{static_cast<T>(time1)}, radius{static_cast<T>(radius)}, mat{mat.id} {}
 
-    [[nodiscard]] auto center(double time) const {
+    [[nodiscard]] auto center(T time) const {
         return center0 + ((time - time0) / (time1 - time0)) * (center1 - center0);
     }
 
     [[nodiscard]] bool hit(const ray &r,
                            double t_min,
                            double t_max,
-                           hit_record &rec) const noexcept override {
-        const auto oc = r.origin() - center(r.time());
-        const auto a = r.direction().length_squared();
-        const auto half_b = oc.dot(r.direction());
-        const auto c = oc.length_squared() - radius * radius;
-
-        const auto discriminant = half_b * half_b - a * c;
-        if (discriminant < 0)
+                           hit_record &rec, rng &gen) const noexcept override {
+        T root;
+        if (!nearest_root(r, t_min, t_max, root))
             return false;
-        const auto sqrtd = std::sqrt(discriminant);
-
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (-half_b - sqrtd) / a;
-        if (root < t_min || t_max < root) {
-            root = (-half_b + sqrtd) / a;
-            if (root < t_min || t_max < root)
-                return false;
-        }
 
-        rec.t = root;
+        rec.t = static_cast<real>(root);
         rec.p = r.at(rec.t);
-        const auto outward_normal = (rec.p - center(r.time())) / radius;
-        rec.set_face_normal(r, outward_normal);
-        rec.mat_ptr = mat_ptr;
+        const auto outward_normal = (basic_vec3<T>{rec.p} - center(r.time())) / radius;
+        rec.set_face_normal(r, vec3{outward_normal});
+        rec.mat = mat;
 
         return true;
     }
 
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        T root;
+        return nearest_root(r, t_min, t_max, root);
+    }
+
     [[nodiscard]] bool bounding_box(double _time0, double _time1, aabb &output_box) const noexcept override {
-        const auto v = vec3{radius, radius, radius};
+        const auto v = basic_vec3<T>{radius, radius, radius};
         aabb box0{
-            center(_time0) - v,
-            center(_time0) + v
+            point3{center(_time0) - v},
+            point3{center(_time0) + v}
         };
         aabb box1{
-                center(_time1) - v,
-                center(_time1) + v
+                point3{center(_time1) - v},
+                point3{center(_time1) + v}
         };
         output_box = surrounding_box(box0, box1);
         return true;
     }
+
+private:
+    // As basic_sphere::nearest_root, with the sphere where it is at the ray's time.
+    [[nodiscard]] bool nearest_root(const ray &r, double t_min, double t_max, T &root) const noexcept {
+        const basic_vec3<T> direction{r.direction()};
+        const auto oc = basic_vec3<T>{r.origin()} - center(r.time());
+        const auto a = direction.length_squared();
+        const auto half_b = oc.dot(direction);
+        const auto c = oc.length_squared() - radius * radius;
+
+        const auto discriminant = half_b * half_b - a * c;
+        if (discriminant < 0)
+            return false;
+        const auto sqrtd = std::sqrt(discriminant);
+
+        // Find the nearest root that lies in the acceptable range.
+        root = (-half_b - sqrtd) / a;
+        if (root < t_min || t_max < root) {
+            root = (-half_b + sqrtd) / a;
+            if (root < t_min || t_max < root)
+                return false;
+        }
+        return true;
+    }
 };
+
+using moving_sphere = basic_moving_sphere<real>;
@@ -0,0 +1,50 @@
+/**
+ * onb.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <array>
+#include <cmath>
+
+#include "vec3.h"
+
+// An orthonormal basis whose w axis is a given direction, for turning directions sampled about the z axis into
+// directions about w. The u and v axes are those of Duff et al., "Building an Orthonormal Basis, Revisited", which
+// needs no branch on the axis nearest w and no normalization beyond that of w.
+class onb final {
+public:
+    std::array<vec3, 3> axis;
+
+    explicit onb(const vec3 &n) noexcept {
+        *this = from_unit(n.unit_vector());
+    }
+
+    // The basis about w, which is already a unit vector, such as a surface normal.
+    [[nodiscard]] static onb from_unit(const vec3 &w) noexcept {
+        onb basis;
+        const auto sign = std::copysign(1.0, static_cast<double>(w.z()));
+        const auto a = -1 / (sign + w.z());
+        const auto b = w.x() * w.y() * a;
+        basis.axis = {vec3{1 + sign * w.x() * w.x() * a, sign * b, -sign * w.x()},
+                      vec3{b, sign + w.y() * w.y() * a, -w.y()},
+                      w};
+        return basis;
+    }
+
+    [[nodiscard]] const vec3 &u() const noexcept { return axis[0]; }
+    [[nodiscard]] const vec3 &v() const noexcept { return axis[1]; }
+    [[nodiscard]] const vec3 &w() const noexcept { return axis[2]; }
+
+    [[nodiscard]] vec3 local(double a, double b, double c) const noexcept {
+        return a * u() + b * v() + c * w();
+    }
+
+    [[nodiscard]] vec3 local(const vec3 &a) const noexcept {
+        return local(a.x(), a.y(), a.z());
+    }
+
+private:
+    onb() = default;
+};
@@ -0,0 +1,108 @@
+/**
+ * packet.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#if defined(__AVX__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "aabb.h"
+#include "ray.h"
+#include "rng.h"
+
+struct hit_record;
+
+// A packet of up to eight coherent rays, traversed through the scene together (see hittable::hit_packet).
+// Lanes are identified by bits in a mask. Each lane keeps its own sample stream, its own closest hit so far in t_max,
+// and writes its hit into its own hit_record, so a lane sees exactly what it would have seen if traced alone.
+struct ray_packet final {
+    static constexpr int size = 8;
+
+    // Below this many active lanes, a packet is no longer coherent enough to pay for itself and its lanes continue
+    // one ray at a time.
+    static constexpr int min_active = 3;
+
+    int count = 0;
+    std::array<ray, size> rays;
+    std::array<rng*, size> gens{};
+    std::array<hit_record*, size> recs{};
+    alignas(64) std::array<double, size> t_max{};
+
+    // Origins and reciprocal directions, one array per axis, for the SIMD slab test.
+    alignas(64) double org[3][size]{};
+    alignas(64) double inv_dir[3][size]{};
+
+    void add(const ray &r, rng &gen, hit_record &rec, double max_t) noexcept {
+        const auto k = count++;
+        rays[k] = r;
+        gens[k] = &gen;
+        recs[k] = &rec;
+        t_max[k] = max_t;
+        for (auto a = 0; a < 3; ++a) {
+            org[a][k] = r.origin()[a];
+            inv_dir[a][k] = 1.0 / r.direction()[a];
+        }
+    }
+
+    void clear() noexcept {
+        count = 0;
+    }
+
+    [[nodiscard]] std::uint32_t lanes() const noexcept {
+        return (1u << count) - 1;
+    }
+
+    [[nodiscard]] static bool coherent(std::uint32_t active) noexcept {
+        return std::popcount(active) >= min_active;
+    }
+
+    // The active lanes whose rays hit box within [t_min, t_max]. This is the slab test of aabb::hit, lane for lane:
+    // the min/max operand order matches its comparisons, so NaNs from axis-parallel rays resolve the same way.
+    [[nodiscard]] std::uint32_t hit_box(const aabb &box, std::uint32_t active, double t_min) const noexcept {
+        std::uint32_t result = 0;
+
+#if defined(__AVX512F__)
+        const auto lo = _mm512_set1_pd(t_min);
+        auto near = lo;
+        auto far = _mm512_load_pd(t_max.data());
+        for (auto a = 0; a < 3; ++a) {
+            const auto o = _mm512_load_pd(org[a]);
+            const auto inv = _mm512_load_pd(inv_dir[a]);
+            const auto t0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(box.minimum[a]), o), inv);
+            const auto t1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(box.maximum[a]), o), inv);
+            const auto negative = _mm512_cmp_pd_mask(inv, _mm512_setzero_pd(), _CMP_LT_OQ);
+            near = _mm512_max_pd(_mm512_mask_blend_pd(negative, t0, t1), near);
+            far = _mm512_min_pd(_mm512_mask_blend_pd(negative, t1, t0), far);
+        }
+        result = _mm512_cmp_pd_mask(far, near, _CMP_GT_OQ);
+#elif defined(__AVX__)
+        for (auto base = 0; base < size; base += 4) {
+            auto near = _mm256_set1_pd(t_min);
+            auto far = _mm256_load_pd(t_max.data() + base);
+            for (auto a = 0; a < 3; ++a) {
+                const auto o = _mm256_load_pd(org[a] + base);
+                const auto inv = _mm256_load_pd(inv_dir[a] + base);
+                const auto t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box.minimum[a]), o), inv);
+                const auto t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box.maximum[a]), o), inv);
+                const auto negative = _mm256_cmp_pd(inv, _mm256_setzero_pd(), _CMP_LT_OQ);
+                near = _mm256_max_pd(_mm256_blendv_pd(t0, t1, negative), near);
+                far = _mm256_min_pd(_mm256_blendv_pd(t1, t0, negative), far);
+            }
+            result |= static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(far, near, _CMP_GT_OQ))) << base;
+        }
+#else
+        for (auto k = 0; k < count; ++k)
+            if (box.hit(rays[k], t_min, t_max[k]))
+                result |= 1u << k;
+#endif
+
+        return result & active;
+    }
+};
@@ -5,7 +5,9 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <numeric>
 #include <vector>
 
 #include "rtweekend.h"
@@ -0,0 +1,45 @@
+/**
+ * pixel_stats.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include "rtweekend.h"
+#include "vec3.h"
+
+[[nodiscard]] inline double luminance(const color &c) noexcept {
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// The running mean and variance of the luminance of a pixel's samples, using Welford's algorithm.
+struct pixel_stats final {
+    std::uint64_t count = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+
+    void add(const color &sample) noexcept {
+        const auto x = luminance(sample);
+        ++count;
+        const auto delta = x - mean;
+        mean += delta / static_cast<double>(count);
+        m2 += delta * (x - mean);
+    }
+
+    [[nodiscard]] double variance() const noexcept {
+        return count > 1 ? m2 / static_cast<double>(count - 1) : 0.0;
+    }
+
+    // The estimated error of the pixel once written out. Output is gamma-corrected with gamma 2 (see color.h), and
+    // the derivative of sqrt(x) is 1 / (2 sqrt(x)), so the standard error of the mean is scaled accordingly. Dark
+    // pixels are not allowed to blow up the estimate.
+    [[nodiscard]] double display_error() const noexcept {
+        if (count == 0)
+            return infinity;
+        const auto standard_error = std::sqrt(variance() / static_cast<double>(count));
+        return standard_error / (2 * std::sqrt(std::fmax(mean, 1e-3)));
+    }
+};
@@ -0,0 +1,182 @@
+/**
+ * primitive.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "aarect.h"
+#include "box.h"
+#include "constant_medium.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "moving_sphere.h"
+#include "sphere.h"
+
+// The hittables the renderer ships with, stored by value, or any other hittable behind a pointer. A primitive is
+// intersected by a switch on its alternative, which calls the (final) hit of the concrete type directly, so the
+// compiler can inline it; only the pointer alternative makes a virtual call. Objects that the shipped hittables own,
+// such as the child of a translate or the sides of a box, remain behind their pointers.
+using primitive = std::variant<sphere,
+                               moving_sphere,
+                               xy_rect,
+                               xz_rect,
+                               yz_rect,
+                               box,
+                               constant_medium,
+                               translate,
+                               rotate_y,
+                               std::shared_ptr<hittable>>;
+
+// A copy of object as a primitive, by value if its type is one of the shipped ones.
+[[nodiscard]] primitive make_primitive(const std::shared_ptr<hittable> &object) {
+    const auto p = object.get();
+    if (const auto s = dynamic_cast<const sphere*>(p))
+        return *s;
+    if (const auto s = dynamic_cast<const moving_sphere*>(p))
+        return *s;
+    if (const auto r = dynamic_cast<const xy_rect*>(p))
+        return *r;
+    if (const auto r = dynamic_cast<const xz_rect*>(p))
+        return *r;
+    if (const auto r = dynamic_cast<const yz_rect*>(p))
+        return *r;
+    if (const auto b = dynamic_cast<const box*>(p))
+        return *b;
+    if (const auto m = dynamic_cast<const constant_medium*>(p))
+        return *m;
+    if (const auto t = dynamic_cast<const translate*>(p))
+        return *t;
+    if (const auto r = dynamic_cast<const rotate_y*>(p))
+        return *r;
+    return object;
+}
+
+static_assert(std::variant_size_v<primitive> == 10, "hit dispatches on every alternative of primitive");
+
+[[nodiscard]] inline bool hit(const primitive &p,
+                              const ray &r,
+                              double t_min,
+                              double t_max,
+                              hit_record &rec,
+                              rng &gen) noexcept {
+    switch (p.index()) {
+        case 0: return std::get_if<0>(&p)->hit(r, t_min, t_max, rec, gen);
+        case 1: return std::get_if<1>(&p)->hit(r, t_min, t_max, rec, gen);
+        case 2: return std::get_if<2>(&p)->hit(r, t_min, t_max, rec, gen);
+        case 3: return std::get_if<3>(&p)->hit(r, t_min, t_max, rec, gen);
+        case 4: return std::get_if<4>(&p)->hit(r, t_min, t_max, rec, gen);
+        case 5: return std::get_if<5>(&p)->hit(r, t_min, t_max, rec, gen);
+        case 6: return std::get_if<6>(&p)->hit(r, t_min, t_max, rec, gen);
+        case 7: return std::get_if<7>(&p)->hit(r, t_min, t_max, rec, gen);
+        case 8: return std::get_if<8>(&p)->hit(r, t_min, t_max, rec, gen);
+        default: return (*std::get_if<9>(&p))->hit(r, t_min, t_max, rec, gen);
+    }
+}
+
+[[nodiscard]] inline bool occluded(const primitive &p, const ray &r, double t_min, double t_max, rng &gen) noexcept {
+    switch (p.index()) {
+        case 0: return std::get_if<0>(&p)->occluded(r, t_min, t_max, gen);
+        case 1: return std::get_if<1>(&p)->occluded(r, t_min, t_max, gen);
+        case 2: return std::get_if<2>(&p)->occluded(r, t_min, t_max, gen);
+        case 3: return std::get_if<3>(&p)->occluded(r, t_min, t_max, gen);
+        case 4: return std::get_if<4>(&p)->occluded(r, t_min, t_max, gen);
+        case 5: return std::get_if<5>(&p)->occluded(r, t_min, t_max, gen);
+        case 6: return std::get_if<6>(&p)->occluded(r, t_min, t_max, gen);
+        case 7: return std::get_if<7>(&p)->occluded(r, t_min, t_max, gen);
+        case 8: return std::get_if<8>(&p)->occluded(r, t_min, t_max, gen);
+        default: return (*std::get_if<9>(&p))->occluded(r, t_min, t_max, gen);
+    }
+}
+
+[[nodiscard]] inline bool bounding_box(const primitive &p, double time0, double time1, aabb &output_box) noexcept {
+    return std::visit([&](const auto &object) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(object)>, std::shared_ptr<hittable>>)
+            return object->bounding_box(time0, time1, output_box);
+        else
+            return object.bounding_box(time0, time1, output_box);
+    }, p);
+}
+
+// A linear_bvh whose primitives are stored by value in one array of primitives, rather than each in an allocation of
+// its own behind a shared_ptr, and intersected without virtual calls.
+class primitive_bvh final : public hittable {
+public:
+    std::vector<linear_bvh::node> nodes;
+    std::vector<primitive> primitives;
+
+    explicit primitive_bvh(const linear_bvh &bvh) : nodes{bvh.nodes} {
+        primitives.reserve(bvh.primitives.size());
+        for (const auto &object: bvh.primitives)
+            primitives.emplace_back(make_primitive(object));
+    }
+
+    [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
+        output_box = nodes.front().box;
+        return true;
+    }
+
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
+        return linear_bvh::traverse(nodes, value_leaves{primitives}, 0, r, t_min, t_max, rec, gen);
+    }
+
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        hit_record unused;
+        return linear_bvh::traverse<false, true>(nodes, value_leaves{primitives}, 0, r, t_min, t_max, unused, gen);
+    }
+
+    [[nodiscard]] std::uint32_t hit_packet(ray_packet &packet,
+                                           std::uint32_t active,
+                                           double t_min) const noexcept override {
+        return linear_bvh::traverse_packet(nodes, value_leaves{primitives}, packet, active, t_min);
+    }
+
+private:
+    // The leaves of a primitive_bvh. The primitives have no packet tests of their own, so a leaf tests the lanes of a
+    // packet one ray at a time, as hittable::hit_packet does.
+    struct value_leaves final {
+        const std::vector<primitive> &primitives;
+
+        [[nodiscard]] bool hit(std::uint32_t p,
+                               const ray &r,
+                               double t_min,
+                               double t_max,
+                               hit_record &rec,
+                               rng &gen) const noexcept {
+            return ::hit(primitives[p], r, t_min, t_max, rec, gen);
+        }
+
+        [[nodiscard]] bool occluded(std::uint32_t p,
+                                    const ray &r,
+                                    double t_min,
+                                    double t_max,
+                                    rng &gen) const noexcept {
+            return ::occluded(primitives[p], r, t_min, t_max, gen);
+        }
+
+        [[nodiscard]] std::uint32_t hit_packet(std::uint32_t p,
+                                               ray_packet &packet,
+                                               std::uint32_t active,
+                                               double t_min) const noexcept {
+            std::uint32_t hits = 0;
+            for (; active; active &= active - 1) {
+                const auto k = std::countr_zero(active);
+                if (hit(p, packet.rays[k], t_min, packet.t_max[k], *packet.recs[k], *packet.gens[k])) {
+                    packet.t_max[k] = packet.recs[k]->t;
+                    hits |= 1u << k;
+                }
+            }
+            return hits;
+        }
+    };
+};
@@ -6,25 +6,32 @@
 
 #include "vec3.h"
 
-class ray final {
+template<typename T>
+class basic_ray final {
 private:
-    point3 orig;
-    vec3 dir;
-    double tm;
+    basic_vec3<T> orig;
+    basic_vec3<T> dir;
+    T tm;
 
 public:
-    ray() noexcept = default;
-    ray(const point3 &origin,
-        const vec3 &direction) noexcept: orig{origin}, dir{direction}, tm{0} {}
-    ray(const point3 &origin,
-        const vec3 &direction,
-        double time = 0.0) noexcept: orig{origin}, dir{direction}, tm{time} {}
+    basic_ray() noexcept = default;
+    basic_ray(const basic_vec3<T> &origin,
+              const basic_vec3<T> &direction) noexcept: orig{origin}, dir{direction}, tm{0} {}
+    basic_ray(const basic_vec3<T> &origin,
+              const basic_vec3<T> &direction,
+              double time = 0.0) noexcept: orig{origin}, dir{direction}, tm{static_cast<T>(time)} {}
+
+    template<typename U>
+    explicit basic_ray(const basic_ray<U> &r) noexcept
+    : orig{r.origin()}, dir{r.direction()}, tm{static_cast<T>(r.time())} {}
 
     [[nodiscard]] auto origin() const noexcept { return orig; }
     [[nodiscard]] auto direction() const noexcept { return dir; }
     [[nodiscard]] auto time() const noexcept { return tm; }
 
-    [[nodiscard]] auto at(const double t) const noexcept {
+    [[nodiscard]] auto at(const T t) const noexcept {
         return orig + t * dir;
     }
 };
+
+using ray = basic_ray<real>;
@@ -0,0 +1,59 @@
+/**
+ * rng.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// PCG32 (O'Neill, 2014): a 64-bit LCG whose output is permuted down to 32 bits.
+// Generators are cheap to create and hold no shared state, so every thread (or every sample) gets its own stream.
+class rng final {
+private:
+    static constexpr std::uint64_t multiplier = 6364136223846793005ULL;
+
+    std::uint64_t state;
+    std::uint64_t inc;
+
+    void step() noexcept {
+        state = state * multiplier + inc;
+    }
+
+public:
+    // SplitMix64 finalizer, used to turn structured (pixel, sample) coordinates into well-spread seeds and hashes.
+    [[nodiscard]] static constexpr std::uint64_t mix64(std::uint64_t x) noexcept {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    explicit rng(std::uint64_t seed, std::uint64_t sequence = 0) noexcept
+    : state{0}, inc{(sequence << 1u) | 1u} {
+        step();
+        state += seed;
+        step();
+    }
+
+    // The stream for one sample of one pixel. Each pixel gets its own PCG sequence and each sample its own starting
+    // point, so the result of a sample does not depend on which thread renders it or in what order.
+    [[nodiscard]] static rng for_sample(std::uint64_t pixel, std::uint64_t sample, std::uint64_t seed = 0) noexcept {
+        return rng{mix64(seed ^ mix64(sample + 1)), mix64(pixel)};
+    }
+
+    [[nodiscard]] std::uint32_t next_uint() noexcept {
+        const auto old = state;
+        step();
+        const auto xorshifted = static_cast<std::uint32_t>(((old >> 18u) ^ old) >> 27u);
+        const auto rot = static_cast<std::uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31u));
+    }
+
+    // A double in [0, 1).
+    [[nodiscard]] double next_double() noexcept {
+        return next_uint() * 0x1p-32;
+    }
+};
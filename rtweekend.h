@@ -8,7 +8,9 @@
 #include <cmath>
 #include <limits>
 #include <memory>
-#include <random>
+#include <type_traits>
+
+#include "rng.h"
 
 // stb_image processing
 #ifdef _MSC_VER
@@ -22,6 +24,19 @@
 #pragma warning (pop)
 #endif
 
+// The scalar type of the geometry: vec3, ray, aabb, the primitives and the camera. Define RTWEEKEND_FLOAT (the CMake
+// option of the same name) to render in float.
+#ifdef RTWEEKEND_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
+// Hits nearer than this along a ray are ignored, so that a ray leaving a surface does not hit it again through the
+// rounding of its origin. In float, the hit points of the scenes that are hundreds of units across are rounded by
+// enough to need ten times the distance.
+constexpr double ray_t_min = std::is_same_v<real, float> ? 1e-2 : 1e-3;
+
 using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
@@ -37,20 +52,29 @@ const auto pi = M_PI;
     return std::min(std::max(x, min), max);
 }
 
+// Only used while building scenes, and seeded with a constant so the same scene is generated on every run.
+// Rendering draws from the per-sample streams handed down by the renderer.
 namespace global_rng {
-    std::random_device rd;
-    std::mt19937 generator(rd());
-    std::uniform_real_distribution<> distribution(0.0, 1.0);
+    constexpr std::uint64_t seed = 0x853c49e6748fea9bULL;
+    thread_local rng generator{seed};
 }
 
 [[nodiscard]] inline auto random_double() noexcept {
-    return global_rng::distribution(global_rng::generator);
+    return global_rng::generator.next_double();
 }
 
 [[nodiscard]] inline auto random_double(double min, double max) {
     return min + (max - min) * random_double();
 }
 
+[[nodiscard]] inline auto random_double(rng &gen) noexcept {
+    return gen.next_double();
+}
+
+[[nodiscard]] inline auto random_double(rng &gen, double min, double max) noexcept {
+    return min + (max - min) * random_double(gen);
+}
+
 [[nodiscard]] inline auto random_int(int min, int max) {
     return static_cast<int>(random_double(min, max + 1));
 }
@@ -0,0 +1,305 @@
+/**
+ * sampler.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+#include "rtweekend.h"
+#include "sampling.h"
+
+// How the samples of a pixel are spread over the dimensions of its sample space: the pixel jitter, lens and time of
+// the camera ray, and then the BSDF sample of each bounce (see sample_point and bounce_sample). Random numbers that
+// these do not cover, such as light samples, Russian roulette, media and the scattering of polymorphic materials,
+// still come from the path's rng.
+//
+// - independent: every value is drawn from the rng when it is needed, in the same order and number as before there
+//   were samplers, so that the images are the same as then.
+// - stratified: the samples are taken in rounds of samples_per_round. In each round, each pair of dimensions is split
+//   into a grid of samples_per_round cells, and each 1D dimension into as many intervals; each sample is jittered
+//   within its own cell. The cells are assigned to the samples by a permutation that differs per pixel, dimension and
+//   round, so that the dimensions do not correlate.
+// - halton: the radical inverse of the sample index in the d-th prime base, with the digits scrambled at random per
+//   pixel and dimension. Dimensions past the table of primes are drawn at random.
+// - sobol: the first two dimensions of the Sobol sequence, Owen scrambled, padded out to every pair of dimensions with
+//   its own scramble and shuffle of the sample indices. The shuffle is an Owen scramble of the index bits (Burley,
+//   "Practical Hash-based Owen Scrambling"), which maps the first 2^k indices onto an aligned block of 2^k indices of
+//   the sequence, and so keeps each power of two prefix of the samples a well spread net. This is best with a power
+//   of two samples per pixel.
+//
+// Each of them is unbiased, and all but independent spread the samples of a pixel more evenly than random numbers, so
+// that images converge faster. None of them depends on the number of samples a pixel will take: its n-th sample is
+// the same whether the render takes n + 1 samples or more, so progressive rendering that raises samples_per_pixel
+// continues the Halton and Sobol sequences and the rounds of strata where the checkpoint left them. Only the round
+// size, which stays fixed, shapes the strata.
+enum class sampler_kind : std::uint8_t {
+    independent,
+    stratified,
+    halton,
+    sobol,
+};
+
+const std::array<const char*, 4> sampler_names{"independent", "stratified", "halton", "sobol"};
+
+class sampler;
+class bounce_sample;
+
+// The place of one path in its pixel's sample space: the dimension that it asks the sampler for next. The camera takes
+// the first camera_dimensions dimensions, and each bounce the next bounce_dimensions, so that the same dimensions feed
+// the same decisions in every sample of the pixel.
+struct sample_point final {
+    static constexpr unsigned camera_dimensions = 5;
+    static constexpr unsigned bounce_dimensions = 3;
+
+    // The sampler, or null to draw every value from the rng.
+    const sampler *source = nullptr;
+    std::uint64_t pixel = 0;
+    std::uint64_t index = 0;
+    unsigned dimension = 0;
+
+    [[nodiscard]] double get_1d(rng &gen) noexcept;
+    [[nodiscard]] sample_2d get_2d(rng &gen) noexcept;
+
+    // The samples of the next bounce, which takes the next bounce_dimensions dimensions whether it uses them or not.
+    [[nodiscard]] bounce_sample bounce(rng &gen) noexcept;
+};
+
+// The samples that a material scatters one bounce by: a 2D sample for its direction, and a 1D one for any other choice
+// it makes, such as whether to reflect or refract. With a sampler, they are the bounce's dimensions of the sample
+// point. Without one, they are drawn from gen only as the material asks for them, so that a lambertian draws two
+// numbers and a dielectric at most one, as the materials did before there were samplers.
+class bounce_sample final {
+private:
+    const sampler *source = nullptr;
+    std::uint64_t pixel = 0;
+    std::uint64_t index = 0;
+    unsigned dimension = 0;
+    rng &gen;
+
+public:
+    explicit bounce_sample(rng &gen) noexcept: gen{gen} {}
+
+    bounce_sample(const sampler *source, std::uint64_t pixel, std::uint64_t index, unsigned dimension,
+                  rng &gen) noexcept
+    : source{source}, pixel{pixel}, index{index}, dimension{dimension}, gen{gen} {}
+
+    [[nodiscard]] sample_2d get_2d() noexcept;
+    [[nodiscard]] double get_1d() noexcept;
+
+    [[nodiscard]] sample_3d get_3d() noexcept {
+        const auto u = get_2d();
+        return {u[0], u[1], get_1d()};
+    }
+};
+
+class sampler final {
+public:
+    sampler_kind kind;
+    std::uint32_t samples_per_round;
+    std::uint64_t seed;
+
+    sampler(sampler_kind kind, int samples_per_round, std::uint64_t seed = 0) noexcept
+    : kind{kind}, samples_per_round{static_cast<std::uint32_t>(std::max(samples_per_round, 1))}, seed{seed} {
+        grid_width = 1;
+        for (std::uint32_t w = 1; w * w <= this->samples_per_round; ++w)
+            if (this->samples_per_round % w == 0)
+                grid_width = w;
+    }
+
+    // The point of sample index of pixel, before the camera has taken any of its dimensions.
+    [[nodiscard]] sample_point start(std::uint64_t pixel, std::uint64_t index) const noexcept {
+        return {kind == sampler_kind::independent ? nullptr : this, pixel, index, 0};
+    }
+
+    [[nodiscard]] double get_1d(std::uint64_t pixel, std::uint64_t index, unsigned dimension) const noexcept {
+        const auto h = dimension_hash(pixel, index, dimension);
+        switch (kind) {
+            case sampler_kind::stratified: {
+                const auto cell = permute(index % samples_per_round, samples_per_round, h);
+                return (cell + uniform(hash(h, index, 1))) / samples_per_round;
+            }
+            case sampler_kind::halton:
+                return dimension < primes.size() ? scrambled_radical_inverse(primes[dimension], index, h)
+                                                 : uniform(hash(h, index, 2));
+            case sampler_kind::sobol:
+                return to_unit(owen_scramble(reverse_bits(sobol_index(index, h)), h));
+            default:
+                return uniform(hash(h, index, 3));
+        }
+    }
+
+    [[nodiscard]] sample_2d get_2d(std::uint64_t pixel, std::uint64_t index, unsigned dimension) const noexcept {
+        const auto h = dimension_hash(pixel, index, dimension);
+        switch (kind) {
+            case sampler_kind::stratified: {
+                const auto cell = permute(index % samples_per_round, samples_per_round, h);
+                const auto height = samples_per_round / grid_width;
+                return {(cell % grid_width + uniform(hash(h, index, 1))) / grid_width,
+                        (cell / grid_width + uniform(hash(h, index, 2))) / height};
+            }
+            case sampler_kind::sobol: {
+                const auto i = sobol_index(index, h);
+                return {to_unit(owen_scramble(reverse_bits(i), h)),
+                        to_unit(owen_scramble(sobol_dimension_1(i), h >> 32))};
+            }
+            default:
+                return {get_1d(pixel, index, dimension), get_1d(pixel, index, dimension + 1)};
+        }
+    }
+
+private:
+    // The width of the stratified grid: the largest divisor of samples_per_round that is at most its square root.
+    std::uint32_t grid_width;
+
+    // The primes that are the bases of the Halton dimensions, which cover the camera and the first 40 bounces.
+    static constexpr auto primes = [] {
+        std::array<std::uint32_t, sample_point::camera_dimensions + 40 * sample_point::bounce_dimensions> p{};
+        std::uint32_t n = 0;
+        for (std::uint32_t candidate = 2; n < p.size(); ++candidate) {
+            auto prime = true;
+            for (std::uint32_t k = 0; k < n && p[k] * p[k] <= candidate; ++k)
+                prime = prime && candidate % p[k] != 0;
+            if (prime)
+                p[n++] = candidate;
+        }
+        return p;
+    }();
+
+    [[nodiscard]] std::uint64_t hash(std::uint64_t a, std::uint64_t b, std::uint64_t c) const noexcept {
+        return rng::mix64(seed ^ rng::mix64(a ^ rng::mix64(b ^ rng::mix64(c + 1))));
+    }
+
+    // The scramble or permutation of a dimension of a pixel. Stratified samples take a new one each round.
+    [[nodiscard]] std::uint64_t dimension_hash(std::uint64_t pixel, std::uint64_t index,
+                                               unsigned dimension) const noexcept {
+        return hash(pixel, dimension, kind == sampler_kind::stratified ? index / samples_per_round : 0);
+    }
+
+    [[nodiscard]] static double uniform(std::uint64_t h) noexcept {
+        return static_cast<double>(h >> 11) * 0x1p-53;
+    }
+
+    [[nodiscard]] static double to_unit(std::uint32_t x) noexcept {
+        return x * 0x1p-32;
+    }
+
+    [[nodiscard]] static std::uint32_t reverse_bits(std::uint32_t x) noexcept {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    // Element index of a permutation of [0, n) chosen by h (Kensler, "Correlated Multi-Jittered Sampling").
+    [[nodiscard]] static std::uint32_t permute(std::uint64_t index, std::uint32_t n, std::uint64_t h) noexcept {
+        const auto p = static_cast<std::uint32_t>(h);
+        auto w = n - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        auto i = static_cast<std::uint32_t>(index);
+        do {
+            i ^= p;
+            i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935fa69;
+            i ^= (i & w) >> 11;
+            i *= 0x74dcb303;
+            i ^= (i & w) >> 2;
+            i *= 0x9e501cc3;
+            i ^= (i & w) >> 2;
+            i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= n);
+        return (i + p) % n;
+    }
+
+    // The index into the Sobol sequence of a sample: an Owen scramble of its bits, each flipped by the ones above it.
+    [[nodiscard]] static std::uint32_t sobol_index(std::uint64_t index, std::uint64_t h) noexcept {
+        return owen_scramble(static_cast<std::uint32_t>(index), rng::mix64(h));
+    }
+
+    // The second dimension of the Sobol sequence, whose generator matrix is Pascal's triangle mod 2. The first is the
+    // bit reversal of the index.
+    [[nodiscard]] static std::uint32_t sobol_dimension_1(std::uint32_t index) noexcept {
+        std::uint32_t x = 0;
+        for (std::uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+            if (index & 1)
+                x ^= v;
+        return x;
+    }
+
+    // A random Owen scramble of the bits of x, from most to least significant, chosen by seed (Burley, "Practical
+    // Hash-based Owen Scrambling", as in pbrt).
+    [[nodiscard]] static std::uint32_t owen_scramble(std::uint32_t x, std::uint64_t seed) noexcept {
+        const auto s = static_cast<std::uint32_t>(seed);
+        x = reverse_bits(x);
+        x ^= x * 0x3d20adea;
+        x += s;
+        x *= (s >> 16) | 1;
+        x ^= x * 0x05526c56;
+        x ^= x * 0x53a22864;
+        return reverse_bits(x);
+    }
+
+    // The radical inverse of index in base, with each digit shifted by an amount that is random per digit position.
+    // The digits past the last of index are zero, so they are shifted to random digits, which together make a random
+    // number below the place of the last digit.
+    [[nodiscard]] static double scrambled_radical_inverse(std::uint32_t base, std::uint64_t index,
+                                                          std::uint64_t h) noexcept {
+        const auto inv_base = 1.0 / base;
+        auto value = 0.0;
+        auto place = inv_base;
+        std::uint64_t position = 0;
+        for (; index != 0; index /= base, place *= inv_base, ++position) {
+            const auto shift = rng::mix64(h ^ position) % base;
+            value += static_cast<double>((index % base + shift) % base) * place;
+        }
+        value += uniform(rng::mix64(h ^ ~position)) * place * base;
+        return std::min(value, 1 - 0x1p-53);
+    }
+};
+
+inline double sample_point::get_1d(rng &gen) noexcept {
+    if (!source)
+        return random_double(gen);
+    return source->get_1d(pixel, index, dimension++);
+}
+
+inline sample_2d sample_point::get_2d(rng &gen) noexcept {
+    if (!source)
+        return random_2d(gen);
+    const auto u = source->get_2d(pixel, index, dimension);
+    dimension += 2;
+    return u;
+}
+
+inline bounce_sample sample_point::bounce(rng &gen) noexcept {
+    const bounce_sample u{source, pixel, index, dimension, gen};
+    dimension += bounce_dimensions;
+    return u;
+}
+
+inline sample_2d bounce_sample::get_2d() noexcept {
+    return source ? source->get_2d(pixel, index, dimension) : random_2d(gen);
+}
+
+inline double bounce_sample::get_1d() noexcept {
+    return source ? source->get_1d(pixel, index, dimension + 2) : random_double(gen);
+}
@@ -0,0 +1,111 @@
+/**
+ * sampling.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <utility>
+
+#include "rtweekend.h"
+#include "vec3.h"
+
+// Closed-form warps from uniform samples in the unit square (or cube) to the shapes and distributions that the camera,
+// materials and lights sample. Unlike the rejection loops of vec3.h, each warp takes a fixed number of uniform numbers,
+// so that any sequence of points, random or low-discrepancy, can drive it, and neighbouring points map to neighbouring
+// points. Directions are about the z axis; an onb turns them about another.
+using sample_2d = std::array<double, 2>;
+using sample_3d = std::array<double, 3>;
+
+[[nodiscard]] inline sample_2d random_2d(rng &gen) noexcept {
+    return {random_double(gen), random_double(gen)};
+}
+
+[[nodiscard]] inline sample_3d random_3d(rng &gen) noexcept {
+    return {random_double(gen), random_double(gen), random_double(gen)};
+}
+
+// The sine and cosine of x in [-pi/4, pi/4], by their Taylor polynomials, which are within 1e-11 of them there. The
+// warps only need angles in a quadrant, and std::sin and std::cos would cost more than the rest of the warp.
+[[nodiscard]] inline std::pair<double, double> sin_cos_reduced(double x) noexcept {
+    const auto x2 = x * x;
+    const auto s = x * (1 + x2 * (-1.0 / 6 + x2 * (1.0 / 120 + x2 * (-1.0 / 5040 + x2 * (1.0 / 362880
+                                                                                       - x2 / 39916800)))));
+    const auto c = 1 + x2 * (-1.0 / 2 + x2 * (1.0 / 24 + x2 * (-1.0 / 720 + x2 * (1.0 / 40320
+                                                                                  + x2 * (-1.0 / 3628800
+                                                                                          + x2 / 479001600)))));
+    return {s, c};
+}
+
+// The sine and cosine of 2 pi u for u in [0, 1], from those of the nearest quarter turn and the angle past it.
+[[nodiscard]] inline std::pair<double, double> sin_cos_turn(double u) noexcept {
+    const auto quarters = 4 * u;
+    const auto quadrant = std::floor(quarters + 0.5);
+    const auto [s, c] = sin_cos_reduced((quarters - quadrant) * (pi / 2));
+    switch (static_cast<int>(quadrant) & 3) {
+        case 0: return {s, c};
+        case 1: return {c, -s};
+        case 2: return {-s, -c};
+        default: return {-c, s};
+    }
+}
+
+// Shirley and Chiu's concentric map from the square onto the unit disk in the xy plane, which keeps strata compact.
+// Each square about the origin maps to the circle of the same radius, with the angles on each of its four sides spread
+// over a quarter turn. Which side a point is on is as likely as not to change from one sample to the next, so the
+// two cases are selected between rather than branched on.
+[[nodiscard]] inline vec3 concentric_disk(const sample_2d &u) noexcept {
+    const auto a = 2 * u[0] - 1;
+    const auto b = 2 * u[1] - 1;
+
+    // On the sides where |a| > |b|, at the angle pi/4 (b / a), and on the others at pi/2 - pi/4 (a / b), whose sine
+    // and cosine are the cosine and sine of pi/4 (a / b).
+    const auto horizontal = std::fabs(a) > std::fabs(b);
+    const auto r = horizontal ? a : b;
+    const auto other = horizontal ? b : a;
+    const auto [s, c] = sin_cos_reduced(r != 0 ? pi / 4 * (other / r) : 0);
+    return vec3{r * (horizontal ? c : s), r * (horizontal ? s : c), 0};
+}
+
+// Directions in the hemisphere about z with density cos(theta) / pi, by lifting the concentric disk onto it (Malley).
+[[nodiscard]] inline vec3 cosine_hemisphere(const sample_2d &u) noexcept {
+    const auto d = concentric_disk(u);
+    const auto z = std::sqrt(std::max(0.0, 1.0 - d.x() * d.x() - d.y() * d.y()));
+    return vec3{d.x(), d.y(), z};
+}
+
+[[nodiscard]] inline double cosine_hemisphere_pdf(double cos_theta) noexcept {
+    return cos_theta > 0 ? cos_theta / pi : 0;
+}
+
+// Unit vectors with density 1 / (4 pi): z is uniform in [-1, 1] by Archimedes' hat-box theorem.
+[[nodiscard]] inline vec3 uniform_sphere(const sample_2d &u) noexcept {
+    const auto z = 1 - 2 * u[0];
+    const auto r = std::sqrt(std::max(0.0, 1 - z * z));
+    const auto [s, c] = sin_cos_turn(u[1]);
+    return vec3{r * c, r * s, z};
+}
+
+[[nodiscard]] inline double uniform_sphere_pdf() noexcept {
+    return 1 / (4 * pi);
+}
+
+// Points uniform in the unit ball: a uniform direction at a radius whose cube is uniform.
+[[nodiscard]] inline vec3 uniform_ball(const sample_3d &u) noexcept {
+    return std::cbrt(u[2]) * uniform_sphere({u[0], u[1]});
+}
+
+// Directions uniform in the cone about z of the directions within an angle of theta_max, by its cosine.
+[[nodiscard]] inline vec3 uniform_cone(const sample_2d &u, double cos_theta_max) noexcept {
+    const auto z = 1 - u[0] * (1 - cos_theta_max);
+    const auto r = std::sqrt(std::max(0.0, 1 - z * z));
+    const auto [s, c] = sin_cos_turn(u[1]);
+    return vec3{r * c, r * s, z};
+}
+
+[[nodiscard]] inline double uniform_cone_pdf(double cos_theta_max) noexcept {
+    return 1 / (2 * pi * (1 - cos_theta_max));
+}
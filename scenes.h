@@ -0,0 +1,443 @@
+/**
+ * scenes.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include "rtweekend.h"
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "bvh_builder.h"
+#include "camera.h"
+#include "constant_medium.h"
+#include "hittable_list.h"
+#include "lights.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "material_table.h"
+#include "motion_bvh.h"
+#include "moving_sphere.h"
+#include "primitive.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "wide_bvh.h"
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// The pointer tree of bvh_node, the binary linear_bvh, or a wide_bvh with 4 or 8 children per node.
+enum class bvh_layout {
+    tree,
+    linear,
+    wide4,
+    wide8,
+};
+
+// How the scenes build and lay out their BVHs. The pointer tree and the median split are kept for comparison (see
+// bench.cpp).
+struct bvh_settings final {
+    bvh_layout layout = bvh_layout::linear;
+    bvh_split split = bvh_split::sah;
+    bvh_build_options options;
+
+    // Gather the spheres in each leaf into sphere_sets (see sphere_set.h). This pays off on scenes made mostly of
+    // spheres, and with leaves of sphere_set::width primitives and a traversal_cost of about 4, so that the sets are
+    // full; with the default leaves it is no faster than testing the spheres one at a time.
+    bool pack_spheres = false;
+
+    // Give BVHs built over a time range bounds at this many time keys (see motion_bvh.h), or 0 to bound the primitives
+    // over the whole range. Their trees are then split on the bounds at the middle of the range, and are binary
+    // whatever the layout.
+    int motion_keys = 0;
+
+    // Store the primitives of linear BVHs by value and intersect them without virtual calls (see primitive.h).
+    bool by_value = false;
+};
+
+inline bvh_settings scene_bvh;
+
+[[nodiscard]] std::shared_ptr<hittable> make_bvh(const hittable_list &list, double time0 = 0.0, double time1 = 0.0) {
+    // bvh_node draws its split axes from the scene generator. Restore it afterwards, so that the rest of the scene
+    // comes out the same whichever way its BVHs are built.
+    const auto state = global_rng::generator;
+    std::shared_ptr<hittable> bvh;
+    if (scene_bvh.layout == bvh_layout::tree) {
+        bvh = make_shared<bvh_node>(list, time0, time1);
+    } else if (scene_bvh.motion_keys > 0 && time1 > time0) {
+        const auto middle = 0.5 * (time0 + time1);
+        auto binary = build_bvh(list, middle, middle, scene_bvh.split, scene_bvh.options);
+        if (scene_bvh.pack_spheres)
+            binary = pack_spheres(*binary);
+        bvh = make_shared<motion_bvh>(*binary, time0, time1, scene_bvh.motion_keys);
+    } else {
+        auto binary = build_bvh(list, time0, time1, scene_bvh.split, scene_bvh.options);
+        if (scene_bvh.pack_spheres)
+            binary = pack_spheres(*binary);
+        if (scene_bvh.layout == bvh_layout::wide4)
+            bvh = make_shared<wide_bvh<4>>(*binary);
+        else if (scene_bvh.layout == bvh_layout::wide8)
+            bvh = make_shared<wide_bvh<8>>(*binary);
+        else if (scene_bvh.by_value)
+            bvh = make_shared<primitive_bvh>(*binary);
+        else
+            bvh = binary;
+    }
+    global_rng::generator = state;
+    return bvh;
+}
+
+[[nodiscard]] auto random_scene() noexcept {
+    hittable_list world;
+
+    const auto checker = make_shared<checker_texture>(
+            color{0.2, 0.3, 0.1},
+            color{0.9, 0.9, 0.9}
+            );
+    const auto ground_material = make_shared<lambertian>(checker);
+    // The ground is intersected in double even in float builds: at its radius, the quadratic cancels most of the
+    // digits of a float.
+    world.add(make_shared<basic_sphere<double>>(point3{0, -1000, 0}, 1000, ground_material));
+
+    for (auto a = -11; a < 11; ++a) {
+        for (auto b = -11; b < 11; ++b) {
+            const point3 center{a + 0.9 * random_double(), 0.2, b + 0.9 * random_double()};
+
+            if ((center - point3{4, 0.2, 0}).length() > 0.9) {
+                const auto choose_mat = random_double();
+
+                // The materials go straight into the material table, rather than each into an object of its own.
+                material_id sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // Diffuse.
+                    const auto albedo = color::random() * color::random();
+                    sphere_material = scene_materials.intern(material_record::lambertian(albedo));
+                    const auto center2 = center + vec3{0, random_double(0, 0.5), 0};
+                    world.add(make_shared<moving_sphere>(center, center2,
+                                                         0.0, 1.0, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // Metal
+                    const auto albedo = color::random(0.5, 1);
+                    const auto fuzz = random_double(0, 0.5);
+                    sphere_material = scene_materials.intern(material_record::metal(albedo, fuzz));
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                } else {
+                    // Glass
+                    sphere_material = scene_materials.intern(material_record::dielectric(1.5));
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    const auto material1 = make_shared<dielectric>(1.5);
+    const auto material2 = make_shared<lambertian>(color{0.4, 0.2, 0.1});
+    const auto material3 = make_shared<metal>(color{0.7, 0.6, 0.5}, 0.0);
+
+    world.add(make_shared<sphere>(point3{0, 1, 0}, 1.0, material1));
+    world.add(make_shared<sphere>(point3{-4, 1, 0}, 1.0, material2));
+    world.add(make_shared<sphere>(point3{4, 1, 0}, 1.0, material3));
+    return hittable_list(make_bvh(world, 0.0, 1.0));
+}
+
+hittable_list two_spheres() {
+    hittable_list objects;
+
+    const auto texture = make_shared<checker_texture>(
+            color{0.2, 0.3, 0.1},
+            color(0.9, 0.9, 0.9)
+    );
+    const auto material = make_shared<lambertian>(texture);
+    objects.add(make_shared<sphere>(point3{0, -10, 0}, 10, material));
+    objects.add(make_shared<sphere>(point3{0,  10, 0}, 10, material));
+
+    return hittable_list(make_bvh(objects));
+}
+
+hittable_list two_perlin_spheres() {
+    hittable_list objects;
+
+    const auto texture = make_shared<noise_texture>(4);
+    const auto material = make_shared<lambertian>(texture);
+    objects.add(make_shared<basic_sphere<double>>(point3{0, -1000, 0}, 1000, material));
+    objects.add(make_shared<sphere>(point3{0, 2, 0}, 2, material));
+
+    return hittable_list(make_bvh(objects));
+}
+
+hittable_list earth() {
+    const auto earth_texture = make_shared<image_texture>("earthmap.jpg");
+    const auto earth_material = make_shared<lambertian>(earth_texture);
+    const auto globe = make_shared<sphere>(point3{0, 0, 0}, 2, earth_material);
+    return hittable_list{globe};
+}
+
+hittable_list simple_light() {
+    hittable_list objects;
+
+    const auto texture = make_shared<noise_texture>(4);
+    const auto material = make_shared<lambertian>(texture);
+    objects.add(make_shared<basic_sphere<double>>(point3{0, -1000, 0}, 1000, material));
+    objects.add(make_shared<sphere>(point3{0, 2, 0}, 2, material));
+
+    const auto difflight = make_shared<diffuse_light>(color{4, 4, 4});
+    objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
+    objects.add(make_shared<sphere>(point3{0, 7, 0}, 2, difflight));
+
+    return hittable_list(make_bvh(objects));
+}
+
+hittable_list cornell_box() {
+    hittable_list objects;
+
+    const auto red   = make_shared<lambertian>(color{.65, .05, .05});
+    const auto white = make_shared<lambertian>(color{.73, .73, .73});
+    const auto green = make_shared<lambertian>(color{.12, .45, .15});
+    const auto light = make_shared<diffuse_light>(color{15, 15, 15});
+
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<hittable> box1 = make_shared<box>(point3{0, 0, 0}, point3{165, 330, 165}, white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3{265, 0, 295});
+    objects.add(box1);
+
+    shared_ptr<hittable> box2 = make_shared<box>(point3{0, 0, 0}, point3{165, 165, 165}, white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3{130, 0, 65});
+    objects.add(box2);
+
+    return hittable_list(make_bvh(objects));
+}
+
+hittable_list cornell_smoke() {
+    hittable_list objects;
+
+    const auto red   = make_shared<lambertian>(color{.65, .05, .05});
+    const auto white = make_shared<lambertian>(color{.73, .73, .73});
+    const auto green = make_shared<lambertian>(color{.12, .45, .15});
+    const auto light = make_shared<diffuse_light>(color{7, 7, 7});
+
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
+    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
+    objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
+    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
+    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
+
+    shared_ptr<hittable> box1 = make_shared<box>(point3{0, 0, 0}, point3{165, 330, 165}, white);
+    box1 = make_shared<rotate_y>(box1, 15);
+    box1 = make_shared<translate>(box1, vec3{265, 0, 295});
+    objects.add(make_shared<constant_medium>(box1, 0.01, BLACK));
+
+    shared_ptr<hittable> box2 = make_shared<box>(point3{0, 0, 0}, point3{165, 165, 165}, white);
+    box2 = make_shared<rotate_y>(box2, -18);
+    box2 = make_shared<translate>(box2, vec3{130, 0, 65});
+    objects.add(make_shared<constant_medium>(box2, 0.01, WHITE));
+
+    return hittable_list(make_bvh(objects));
+}
+
+hittable_list final_scene() {
+    hittable_list boxes1;
+    const auto ground = make_shared<lambertian>(color{0.48, 0.83, 0.53});
+
+    const auto boxes_per_side = 20;
+    for (auto i = 0; i < boxes_per_side; ++i)
+        for (auto j = 0; j < boxes_per_side; ++j) {
+            constexpr auto w = 100.0;
+
+            const auto x0 = -1000.0 + i * w;
+            constexpr auto y0 = 0.0;
+            const auto z0 = -1000.0 + j * w;
+
+            const auto x1 = x0 + w;
+            const auto y1 = random_double(1, 101);
+            const auto z1 = z0 + w;
+
+            boxes1.add(make_shared<box>(point3{x0, y0, z0}, point3{x1, y1, z1}, ground));
+        }
+
+    hittable_list objects;
+    objects.add(make_bvh(boxes1, 0, 1));
+
+    const auto light = make_shared<diffuse_light>(color{7, 7, 7});
+    objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+
+    const auto center1 = point3{400, 400, 200};
+    const auto center2 = center1 + vec3{30, 0, 0};
+    const auto moving_sphere_material = make_shared<lambertian>(color{0.7, 0.3, 0.1});
+    objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+
+    const auto dielec = make_shared<dielectric>(1.5);
+    objects.add(make_shared<sphere>(point3{260, 150, 45}, 50, dielec));
+    objects.add(make_shared<sphere>(point3{0, 150, 145}, 50, make_shared<metal>(color{0.8, 0.8, 0.9}, 1.0)));
+
+    const auto boundary1 = make_shared<sphere>(point3{360, 150, 145}, 70, dielec);
+    objects.add(boundary1);
+    objects.add(make_shared<constant_medium>(boundary1, 0.2, color{0.2, 0.4, 0.9}));
+
+    // In double, like the ground of random_scene.
+    const auto boundary2 = make_shared<basic_sphere<double>>(point3{0, 0, 0}, 5000, dielec);
+    objects.add(make_shared<constant_medium>(boundary2, 1e-4, WHITE));
+
+    const auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
+    objects.add(make_shared<sphere>(point3{400, 200, 400}, 100, emat));
+
+    const auto pertext = make_shared<noise_texture>(0.1);
+    objects.add(make_shared<sphere>(point3{220, 280, 300}, 80, make_shared<lambertian>(pertext)));
+
+    hittable_list boxes2;
+    const auto white = make_shared<lambertian>(color{0.73, 0.73, 0.73});
+    constexpr auto ns = 1000;
+    for (auto j = 0; j < ns; ++j)
+        boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
+
+    objects.add(make_shared<translate>(
+            make_shared<rotate_y>(
+                    make_bvh(boxes2, 0.0, 1.0), 15),
+                    vec3{-100, 270, 395}
+            )
+    );
+
+//    return objects;
+    return hittable_list(make_bvh(objects, 0.0, 1.0));
+}
+
+// A built-in scene together with the camera and render settings it is meant to be viewed with.
+struct scene final {
+    const char *name = "";
+    hittable_list world;
+    double aspect_ratio = 16.0 / 9.0;
+    int image_width = 1000;
+    int samples_per_pixel = 500;
+    point3 lookfrom{13, 2, 3};
+    point3 lookat{0, 0, 0};
+    double vfov = 20.0; // 40.0
+    double aperture = 0.0;
+    color background{0.70, 0.80, 1.00}; // BLACK
+
+    // The lights of world that the integrators can sample directly.
+    light_list lights;
+
+    [[nodiscard]] int image_height() const noexcept {
+        return static_cast<int>(image_width / aspect_ratio);
+    }
+
+    [[nodiscard]] camera make_camera() const noexcept {
+        const vec3 vup{0, 1, 0};
+        const auto dist_to_focus = 10.0;
+        return camera{lookfrom, lookat, vup, vfov,
+                      aspect_ratio, aperture, dist_to_focus,
+                      0.0, 1.0};
+    }
+
+    // A hash (FNV-1a) of the name and of the view and background the scene is rendered with, so that a checkpoint of
+    // one scene is not resumed by another of the same size.
+    [[nodiscard]] std::uint64_t identity() const noexcept {
+        std::uint64_t h = 0xcbf29ce484222325ull;
+        const auto mix = [&h](const void *data, std::size_t size) {
+            for (std::size_t k = 0; k < size; ++k) {
+                h ^= static_cast<const unsigned char*>(data)[k];
+                h *= 0x100000001b3ull;
+            }
+        };
+        mix(name, std::strlen(name));
+        for (const auto value: {lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(), lookat.y(), lookat.z(),
+                                background.x(), background.y(), background.z()}) {
+            const auto v = static_cast<double>(value);
+            mix(&v, sizeof(v));
+        }
+        for (const auto v: {aspect_ratio, vfov, aperture})
+            mix(&v, sizeof(v));
+        return h;
+    }
+};
+
+// The names of the built-in scenes, indexed by their number in select_scene.
+const std::array<const char*, 9> scene_names{
+        "", "random_scene", "two_spheres", "two_perlin_spheres", "earth",
+        "simple_light", "cornell_box", "cornell_smoke", "final_scene"
+};
+
+[[nodiscard]] scene select_scene(int which) {
+    // Start from the same random state, so a scene is the same whatever was built before it.
+    global_rng::generator = rng{global_rng::seed};
+
+    scene s;
+
+    switch (which) {
+        case 1:
+            s.world = random_scene();
+            s.aperture = 0.1;
+            break;
+
+        case 2:
+            s.world = two_spheres();
+            break;
+
+        case 3:
+            s.world = two_perlin_spheres();
+            break;
+
+        case 4:
+            s.world = earth();
+            break;
+
+        case 5:
+            s.world = simple_light();
+            s.samples_per_pixel = 400;
+            s.background = BLACK;
+            s.lookfrom = point3{26, 3, 6};
+            s.lookat = point3{0, 2, 0};
+            break;
+
+        case 6:
+            s.world = cornell_box();
+            s.aspect_ratio = 1.0;
+            s.image_width = 600;
+            s.samples_per_pixel = 200;
+            s.background = BLACK;
+            s.lookfrom = point3{278, 278, -800};
+            s.lookat = point3{278, 278, 0};
+            s.vfov = 40.0;
+            break;
+
+        case 7:
+            s.world = cornell_smoke();
+            s.aspect_ratio = 1.0;
+            s.image_width = 600;
+            s.samples_per_pixel = 200;
+            s.lookfrom = point3{278, 278, -800};
+            s.lookat = point3{278, 278, 0};
+            s.vfov = 40.0;
+            break;
+
+        default:
+        case 8:
+            which = 8;
+            s.world = final_scene();
+            s.aspect_ratio = 1.0;
+            s.image_width = 800;
+            s.samples_per_pixel = 10000;
+            s.background = BLACK;
+            s.lookfrom = point3{478, 278, -600};
+            s.lookat = point3{278, 278, 0};
+            s.vfov = 40.0;
+            break;
+    }
+
+    s.name = scene_names[which];
+    s.lights = light_list{s.world};
+
+    return s;
+}
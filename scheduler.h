@@ -0,0 +1,206 @@
+/**
+ * scheduler.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A square region of the frame: pixels [x0, x1) x [y0, y1).
+struct tile final {
+    int x0, y0;
+    int x1, y1;
+};
+
+// Position of (x, y) along the Hilbert curve filling an n x n grid, where n is a power of two.
+[[nodiscard]] inline std::uint64_t hilbert_index(std::uint32_t n, std::uint32_t x, std::uint32_t y) noexcept {
+    std::uint64_t d = 0;
+    for (auto s = n / 2; s > 0; s /= 2) {
+        const std::uint32_t rx = (x & s) > 0;
+        const std::uint32_t ry = (y & s) > 0;
+        d += static_cast<std::uint64_t>(s) * s * ((3 * rx) ^ ry);
+
+        // Rotate the quadrant so the curve stays continuous.
+        if (ry == 0) {
+            if (rx == 1) {
+                x = s - 1 - x;
+                y = s - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+// Cut the frame into tiles of at most tile_size x tile_size pixels, ordered along a Hilbert curve so that
+// consecutive tiles are spatially adjacent and touch the same parts of the scene.
+[[nodiscard]] std::vector<tile> make_tiles(int width, int height, int tile_size) {
+    const auto tiles_x = (width + tile_size - 1) / tile_size;
+    const auto tiles_y = (height + tile_size - 1) / tile_size;
+
+    std::uint32_t n = 1;
+    while (n < static_cast<std::uint32_t>(std::max(tiles_x, tiles_y)))
+        n *= 2;
+
+    std::vector<std::pair<std::uint64_t, tile>> ordered;
+    ordered.reserve(static_cast<std::size_t>(tiles_x) * tiles_y);
+    for (auto ty = 0; ty < tiles_y; ++ty)
+        for (auto tx = 0; tx < tiles_x; ++tx) {
+            const tile t{tx * tile_size,
+                         ty * tile_size,
+                         std::min((tx + 1) * tile_size, width),
+                         std::min((ty + 1) * tile_size, height)};
+            ordered.emplace_back(hilbert_index(n, tx, ty), t);
+        }
+
+    std::sort(ordered.begin(), ordered.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    std::vector<tile> tiles;
+    tiles.reserve(ordered.size());
+    for (const auto &[_, t]: ordered)
+        tiles.emplace_back(t);
+    return tiles;
+}
+
+// A persistent pool of workers that renders batches of tiles.
+// Each worker owns a deque seeded with a contiguous run of the tile order. It takes work from the front of its own
+// deque and, once empty, steals from the back of the others, so neighbouring tiles stay on the same core.
+class tile_scheduler final {
+private:
+    struct worker_queue final {
+        std::mutex mtx;
+        std::deque<std::size_t> tiles;
+    };
+
+    std::vector<std::unique_ptr<worker_queue>> queues;
+    std::vector<std::jthread> workers;
+
+    std::mutex mtx;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    std::uint64_t generation = 0;
+    std::size_t busy = 0;
+    bool stopping = false;
+
+    const std::vector<tile> *tiles = nullptr;
+    const std::function<void(const tile&)> *job = nullptr;
+    std::atomic<std::size_t> remaining = 0;
+
+    [[nodiscard]] bool next_tile(std::size_t id, std::size_t &index) noexcept {
+        {
+            auto &own = *queues[id];
+            std::lock_guard<std::mutex> lock(own.mtx);
+            if (!own.tiles.empty()) {
+                index = own.tiles.front();
+                own.tiles.pop_front();
+                return true;
+            }
+        }
+
+        for (std::size_t k = 1; k < queues.size(); ++k) {
+            auto &victim = *queues[(id + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if (!victim.tiles.empty()) {
+                index = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void worker_loop(std::size_t id) {
+        std::uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                work_ready.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+
+            std::size_t index;
+            while (next_tile(id, index)) {
+                (*job)((*tiles)[index]);
+                remaining.fetch_sub(1, std::memory_order_relaxed);
+                work_done.notify_one();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                --busy;
+            }
+            work_done.notify_one();
+        }
+    }
+
+public:
+    explicit tile_scheduler(unsigned thread_count = std::thread::hardware_concurrency()) {
+        thread_count = std::max(thread_count, 1u);
+        for (auto i = 0u; i < thread_count; ++i)
+            queues.emplace_back(std::make_unique<worker_queue>());
+        for (auto i = 0u; i < thread_count; ++i)
+            workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    tile_scheduler(const tile_scheduler&) = delete;
+    tile_scheduler &operator=(const tile_scheduler&) = delete;
+
+    ~tile_scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        work_ready.notify_all();
+    }
+
+    [[nodiscard]] auto thread_count() const noexcept { return workers.size(); }
+
+    // Run job over every tile and block until all of them are complete.
+    // progress, if given, is called on the calling thread with the number of tiles still outstanding.
+    void run(const std::vector<tile> &batch,
+             const std::function<void(const tile&)> &fn,
+             const std::function<void(std::size_t)> &progress = {}) {
+        if (batch.empty())
+            return;
+
+        const auto per_worker = (batch.size() + queues.size() - 1) / queues.size();
+        for (std::size_t i = 0; i < batch.size(); ++i)
+            queues[i / per_worker]->tiles.push_back(i);
+
+        std::unique_lock<std::mutex> lock(mtx);
+        tiles = &batch;
+        job = &fn;
+        remaining = batch.size();
+        busy = workers.size();
+        ++generation;
+        work_ready.notify_all();
+
+        auto last_reported = batch.size() + 1;
+        while (busy > 0) {
+            work_done.wait(lock);
+            const auto left = remaining.load(std::memory_order_relaxed);
+            if (progress && left != last_reported) {
+                progress(left);
+                last_reported = left;
+            }
+        }
+
+        tiles = nullptr;
+        job = nullptr;
+    }
+};
@@ -5,38 +5,26 @@
 #pragma once
 
 #include "hittable.h"
+#include "material_table.h"
+#include "onb.h"
+#include "sampling.h"
 #include "vec3.h"
 #include <exception>
 #include <iostream>
 #include <sstream>
 #include <utility>
 
-class sphere final : public hittable {
+// A sphere whose intersections are solved in T, whatever the precision of the renderer. Very large spheres, whose
+// quadratic cancels most of the digits of a float, use basic_sphere<double>.
+template<typename T>
+class basic_sphere final : public hittable {
 private:
-    static void get_sphere_uv(const point3 &p, double &u, double &v) {
-        const auto theta = std::acos(-p.y());
-        const auto phi = std::atan2(-p.z(), p.x()) + pi;
-
-        u = phi / (2 * pi);
-        v = theta / pi;
-    }
-
-public:
-    const point3 center;
-    const double radius;
-    shared_ptr<material> mat_ptr;
-
-    sphere() noexcept: center{point3(0, 0, 0)}, radius{1} {}
-
-    // Allow negative radius for S10.5.
-    sphere(point3 center,
-           double radius,
-           shared_ptr<material> m) noexcept: center{center}, radius{radius}, mat_ptr{std::move(m)} {}
-
-    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec) const noexcept override {
-        const auto oc = r.origin() - center;
-        const auto a = r.direction().length_squared();
-        const auto half_b = oc.dot(r.direction());
+    // The nearest root of the ray's quadratic that lies in [t_min, t_max], if there is one.
+    [[nodiscard]] bool nearest_root(const ray &r, double t_min, double t_max, T &root) const noexcept {
+        const basic_vec3<T> direction{r.direction()};
+        const auto oc = basic_vec3<T>{r.origin()} - center;
+        const auto a = direction.length_squared();
+        const auto half_b = oc.dot(direction);
         const auto c = oc.length_squared() - radius * radius;
 
         const auto discriminant = half_b * half_b - a * c;
@@ -44,30 +32,85 @@ public:
             return false;
         const auto sqrtd = std::sqrt(discriminant);
 
-        // Find the nearest root that lies in the acceptable range.
-        auto root = (-half_b - sqrtd) / a;
+        root = (-half_b - sqrtd) / a;
         if (root < t_min || t_max < root) {
             root = (-half_b + sqrtd) / a;
             if (root < t_min || t_max < root)
                 return false;
         }
+        return true;
+    }
+
+    static void get_sphere_uv(const basic_vec3<T> &p, real &u, real &v) {
+        const auto theta = std::acos(-p.y());
+        const auto phi = std::atan2(-p.z(), p.x()) + pi;
+
+        u = static_cast<real>(phi / (2 * pi));
+        v = static_cast<real>(theta / pi);
+    }
 
-        rec.t = root;
+public:
+    const basic_vec3<T> center;
+    const T radius;
+    material_id mat;
+
+    basic_sphere() noexcept: center{0, 0, 0}, radius{1}, mat{0} {}
+
+    // Allow negative radius for S10.5.
+    basic_sphere(const point3 &center,
+                 double radius,
+                 material_ref m) noexcept
+    : center{center}, radius{static_cast<T>(radius)}, mat{m.id} {}
+
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
+        T root;
+        if (!nearest_root(r, t_min, t_max, root))
+            return false;
+
+        rec.t = static_cast<real>(root);
         rec.p = r.at(rec.t);
-        const auto outward_normal = (rec.p - center) / radius;
-        rec.set_face_normal(r, outward_normal);
+        const auto outward_normal = (basic_vec3<T>{rec.p} - center) / radius;
+        rec.set_face_normal(r, vec3{outward_normal});
         get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat_ptr = mat_ptr;
+        rec.mat = mat;
 
         return true;
     }
 
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        T root;
+        return nearest_root(r, t_min, t_max, root);
+    }
+
+    // Lights are sampled by direction, uniformly within the cone that the sphere subtends at o.
+    [[nodiscard]] double pdf_value(const point3 &o, const vec3 &v, rng &gen) const noexcept override {
+        hit_record rec;
+        if (!hit(ray{o, v, 0.0}, ray_t_min, infinity, rec, gen))
+            return 0;
+
+        const auto distance_squared = (point3{center} - o).length_squared();
+        if (distance_squared <= radius * radius)
+            return 0;
+        return uniform_cone_pdf(std::sqrt(1 - radius * radius / distance_squared));
+    }
+
+    [[nodiscard]] vec3 random(const point3 &o, rng &gen) const noexcept override {
+        const auto direction = point3{center} - o;
+        const auto distance_squared = direction.length_squared();
+        const auto u = random_2d(gen);
+        if (distance_squared <= radius * radius)
+            return direction;
+        return onb{direction}.local(uniform_cone(u, std::sqrt(1 - radius * radius / distance_squared)));
+    }
+
     [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
-        const auto v = vec3{radius, radius, radius};
+        const auto v = basic_vec3<T>{radius, radius, radius};
         output_box = aabb{
-            center - v,
-            center + v
+            point3{center - v},
+            point3{center + v}
         };
         return true;
     }
 };
+
+using sphere = basic_sphere<real>;
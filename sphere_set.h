@@ -0,0 +1,280 @@
+/**
+ * sphere_set.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#if defined(__AVX__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+#include "moving_sphere.h"
+#include "sphere.h"
+
+// Up to eight spheres, static or moving, stored as structure-of-arrays and intersected with one ray at once: the
+// quadratic of every sphere is solved in the SIMD lanes, and only the nearest hit is finished in scalar code. Moving
+// spheres interpolate their centers at the ray's time in their own lanes; a static sphere is one that moves by zero
+// over a unit span.
+//
+// The hits are found with the same arithmetic as sphere::hit and moving_sphere::hit, and finished the same way.
+class sphere_set final : public hittable {
+public:
+    static constexpr int width = 8;
+
+private:
+    // Unused lanes hold spheres of radius 0 at the origin that never move; the lane mask drops them.
+    int count = 0;
+
+    // The center at time0, and its displacement per unit of time.
+    alignas(64) std::array<std::array<double, width>, 3> center0{};
+    alignas(64) std::array<std::array<double, width>, 3> velocity{};
+    alignas(64) std::array<double, width> time0{};
+    alignas(64) std::array<double, width> radius{};
+
+    // Static spheres also produce texture coordinates, as sphere::hit does.
+    std::array<bool, width> moving{};
+
+    std::array<material_id, width> materials{};
+
+    [[nodiscard]] point3 center(int k, double time) const noexcept {
+        const point3 c0{center0[0][k], center0[1][k], center0[2][k]};
+        const vec3 v{velocity[0][k], velocity[1][k], velocity[2][k]};
+        return c0 + (time - time0[k]) * v;
+    }
+
+    void add(const point3 &c0, const vec3 &v, double t0, double r, bool m, material_id mat) {
+        const auto k = count++;
+        for (auto a = 0; a < 3; ++a) {
+            center0[a][k] = c0[a];
+            velocity[a][k] = v[a];
+        }
+        time0[k] = t0;
+        radius[k] = r;
+        moving[k] = m;
+        materials[k] = mat;
+    }
+
+    // The lanes whose sphere the ray hits within [t_min, t_max], and the nearest acceptable root of each.
+    [[nodiscard]] std::uint32_t roots(const ray &r, double t_min, double t_max, double *root) const noexcept {
+        const auto &o = r.origin();
+        const auto &d = r.direction();
+        const auto a = d.length_squared();
+        const auto inv_a = 1.0 / a;
+        std::uint32_t mask = 0;
+
+#if defined(__AVX512F__)
+        const auto time = _mm512_set1_pd(r.time());
+        const auto s = _mm512_sub_pd(time, _mm512_load_pd(time0.data()));
+        __m512d oc[3];
+        for (auto i = 0; i < 3; ++i) {
+            const auto c = _mm512_add_pd(_mm512_load_pd(center0[i].data()),
+                                         _mm512_mul_pd(s, _mm512_load_pd(velocity[i].data())));
+            oc[i] = _mm512_sub_pd(_mm512_set1_pd(o[i]), c);
+        }
+        const auto half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(oc[0], _mm512_set1_pd(d[0])),
+                                                        _mm512_mul_pd(oc[1], _mm512_set1_pd(d[1]))),
+                                          _mm512_mul_pd(oc[2], _mm512_set1_pd(d[2])));
+        const auto rad = _mm512_load_pd(radius.data());
+        const auto c = _mm512_sub_pd(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(oc[0], oc[0]),
+                                                                 _mm512_mul_pd(oc[1], oc[1])),
+                                                   _mm512_mul_pd(oc[2], oc[2])),
+                                     _mm512_mul_pd(rad, rad));
+        const auto va = _mm512_set1_pd(a);
+        const auto discriminant = _mm512_sub_pd(_mm512_mul_pd(half_b, half_b), _mm512_mul_pd(va, c));
+        const auto real = _mm512_cmp_pd_mask(discriminant, _mm512_setzero_pd(), _CMP_GE_OQ);
+        const auto sqrtd = _mm512_sqrt_pd(discriminant);
+
+        const auto neg_half_b = _mm512_sub_pd(_mm512_set1_pd(-0.0), half_b);
+        const auto lo = _mm512_set1_pd(t_min);
+        const auto hi = _mm512_set1_pd(t_max);
+        const auto near = _mm512_mul_pd(_mm512_sub_pd(neg_half_b, sqrtd), _mm512_set1_pd(inv_a));
+        const auto far = _mm512_mul_pd(_mm512_add_pd(neg_half_b, sqrtd), _mm512_set1_pd(inv_a));
+        const auto near_ok = _mm512_cmp_pd_mask(near, lo, _CMP_GE_OQ) & _mm512_cmp_pd_mask(near, hi, _CMP_LE_OQ);
+        const auto far_ok = _mm512_cmp_pd_mask(far, lo, _CMP_GE_OQ) & _mm512_cmp_pd_mask(far, hi, _CMP_LE_OQ);
+        _mm512_store_pd(root, _mm512_mask_blend_pd(near_ok, far, near));
+        mask = real & (near_ok | far_ok);
+#elif defined(__AVX__)
+        const auto time = _mm256_set1_pd(r.time());
+        const auto va = _mm256_set1_pd(a);
+        const auto vinv_a = _mm256_set1_pd(inv_a);
+        const auto lo = _mm256_set1_pd(t_min);
+        const auto hi = _mm256_set1_pd(t_max);
+        for (auto base = 0; base < width; base += 4) {
+            const auto s = _mm256_sub_pd(time, _mm256_load_pd(time0.data() + base));
+            __m256d oc[3];
+            for (auto i = 0; i < 3; ++i) {
+                const auto c = _mm256_add_pd(_mm256_load_pd(center0[i].data() + base),
+                                             _mm256_mul_pd(s, _mm256_load_pd(velocity[i].data() + base)));
+                oc[i] = _mm256_sub_pd(_mm256_set1_pd(o[i]), c);
+            }
+            const auto half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc[0], _mm256_set1_pd(d[0])),
+                                                            _mm256_mul_pd(oc[1], _mm256_set1_pd(d[1]))),
+                                              _mm256_mul_pd(oc[2], _mm256_set1_pd(d[2])));
+            const auto rad = _mm256_load_pd(radius.data() + base);
+            const auto c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc[0], oc[0]),
+                                                                     _mm256_mul_pd(oc[1], oc[1])),
+                                                       _mm256_mul_pd(oc[2], oc[2])),
+                                         _mm256_mul_pd(rad, rad));
+            const auto discriminant = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(va, c));
+            const auto real = _mm256_cmp_pd(discriminant, _mm256_setzero_pd(), _CMP_GE_OQ);
+            const auto sqrtd = _mm256_sqrt_pd(discriminant);
+
+            const auto neg_half_b = _mm256_sub_pd(_mm256_set1_pd(-0.0), half_b);
+            const auto near = _mm256_mul_pd(_mm256_sub_pd(neg_half_b, sqrtd), vinv_a);
+            const auto far = _mm256_mul_pd(_mm256_add_pd(neg_half_b, sqrtd), vinv_a);
+            const auto near_ok = _mm256_and_pd(_mm256_cmp_pd(near, lo, _CMP_GE_OQ),
+                                               _mm256_cmp_pd(near, hi, _CMP_LE_OQ));
+            const auto far_ok = _mm256_and_pd(_mm256_cmp_pd(far, lo, _CMP_GE_OQ),
+                                              _mm256_cmp_pd(far, hi, _CMP_LE_OQ));
+            _mm256_store_pd(root + base, _mm256_blendv_pd(far, near, near_ok));
+            const auto ok = _mm256_and_pd(real, _mm256_or_pd(near_ok, far_ok));
+            mask |= static_cast<std::uint32_t>(_mm256_movemask_pd(ok)) << base;
+        }
+#else
+        for (auto k = 0; k < count; ++k) {
+            const auto oc = o - center(k, r.time());
+            const auto half_b = oc.dot(d);
+            const auto c = oc.length_squared() - radius[k] * radius[k];
+            const auto discriminant = half_b * half_b - a * c;
+            if (discriminant < 0)
+                continue;
+            const auto sqrtd = std::sqrt(discriminant);
+            root[k] = (-half_b - sqrtd) * inv_a;
+            if (root[k] < t_min || t_max < root[k]) {
+                root[k] = (-half_b + sqrtd) * inv_a;
+                if (root[k] < t_min || t_max < root[k])
+                    continue;
+            }
+            mask |= 1u << k;
+        }
+#endif
+
+        return mask & ((1u << count) - 1);
+    }
+
+public:
+    [[nodiscard]] int size() const noexcept {
+        return count;
+    }
+
+    [[nodiscard]] bool full() const noexcept {
+        return count == width;
+    }
+
+    [[nodiscard]] material_id material_of(int k) const noexcept {
+        return materials[k];
+    }
+
+    void add(const sphere &s) {
+        add(s.center, vec3{0, 0, 0}, 0.0, s.radius, false, s.mat);
+    }
+
+    void add(const moving_sphere &s) {
+        add(s.center0, (s.center1 - s.center0) / (s.time1 - s.time0), s.time0, s.radius, true, s.mat);
+    }
+
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        alignas(64) std::array<double, width> root;
+        return roots(r, t_min, t_max, root.data()) != 0;
+    }
+
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
+        alignas(64) std::array<double, width> root;
+        auto mask = roots(r, t_min, t_max, root.data());
+        if (!mask)
+            return false;
+
+        auto k = std::countr_zero(mask);
+        for (mask &= mask - 1; mask; mask &= mask - 1) {
+            const auto j = std::countr_zero(mask);
+            if (root[j] < root[k])
+                k = j;
+        }
+
+        const auto c = center(k, r.time());
+        rec.t = root[k];
+        rec.p = r.at(rec.t);
+        const auto outward_normal = (rec.p - c) / radius[k];
+        rec.set_face_normal(r, outward_normal);
+        if (!moving[k]) {
+            rec.u = (std::atan2(-outward_normal.z(), outward_normal.x()) + pi) / (2 * pi);
+            rec.v = std::acos(-outward_normal.y()) / pi;
+        }
+        rec.mat = materials[k];
+        return true;
+    }
+
+    [[nodiscard]] bool bounding_box(double t0, double t1, aabb &output_box) const noexcept override {
+        for (auto k = 0; k < count; ++k) {
+            const auto v = vec3{radius[k], radius[k], radius[k]};
+            const auto box = surrounding_box(aabb{center(k, t0) - v, center(k, t0) + v},
+                                             aabb{center(k, t1) - v, center(k, t1) + v});
+            output_box = k == 0 ? box : surrounding_box(output_box, box);
+        }
+        return count > 0;
+    }
+};
+
+// Replace the spheres in each leaf of a BVH that holds more than one by sphere_sets of up to sphere_set::width spheres.
+// The other primitives of a leaf stay as they are, after its sets.
+[[nodiscard]] std::shared_ptr<linear_bvh> pack_spheres(const linear_bvh &bvh) {
+    auto nodes = bvh.nodes;
+    std::vector<std::shared_ptr<hittable>> primitives;
+
+    for (auto &n: nodes) {
+        if (n.count == 0)
+            continue;
+
+        const auto first = static_cast<std::uint32_t>(primitives.size());
+        const auto spheres = std::count_if(bvh.primitives.begin() + n.offset, bvh.primitives.begin() + n.offset + n.count,
+                                           [](const std::shared_ptr<hittable> &object) {
+                                               return dynamic_cast<const sphere*>(object.get())
+                                                      || dynamic_cast<const moving_sphere*>(object.get());
+                                           });
+        if (spheres < 2) {
+            primitives.insert(primitives.end(), bvh.primitives.begin() + n.offset,
+                              bvh.primitives.begin() + n.offset + n.count);
+            n.offset = first;
+            continue;
+        }
+
+        std::vector<std::shared_ptr<hittable>> others;
+        std::shared_ptr<sphere_set> set;
+        for (auto p = n.offset; p < n.offset + n.count; ++p) {
+            const auto &object = bvh.primitives[p];
+            const auto s = dynamic_cast<const sphere*>(object.get());
+            const auto m = dynamic_cast<const moving_sphere*>(object.get());
+            if (!s && !m) {
+                others.emplace_back(object);
+                continue;
+            }
+
+            if (!set || set->full()) {
+                set = make_shared<sphere_set>();
+                primitives.emplace_back(set);
+            }
+            if (s)
+                set->add(*s);
+            else
+                set->add(*m);
+        }
+
+        primitives.insert(primitives.end(), others.begin(), others.end());
+        n.offset = first;
+        n.count = static_cast<std::uint16_t>(primitives.size() - first);
+    }
+
+    return make_shared<linear_bvh>(std::move(nodes), std::move(primitives));
+}
@@ -6,76 +6,205 @@
 
 #include <cmath>
 #include <iostream>
+#include <type_traits>
+
+#if defined(RTWEEKEND_SIMD_VEC3) && (defined(__SSE__) || defined(__AVX2__))
+#include <immintrin.h>
+#endif
 
 #include "rtweekend.h"
 
-class vec3 final {
+// The lanes of a vector of three T stored in a SIMD register of four. With RTWEEKEND_SIMD_VEC3, vectors of floats
+// (with SSE) and of doubles (with AVX2) are stored padded to four aligned lanes, and their arithmetic is done on the
+// whole register. The fourth lane is never read, so it needs no particular value.
+template<typename T>
+struct vec3_lanes final {
+    static constexpr bool enabled = false;
+};
+
+#if defined(RTWEEKEND_SIMD_VEC3) && defined(__AVX2__)
+template<>
+struct vec3_lanes<double> final {
+    static constexpr bool enabled = true;
+    using reg = __m256d;
+
+    static reg load(const double *p) noexcept { return _mm256_load_pd(p); }
+    static void store(double *p, reg v) noexcept { _mm256_store_pd(p, v); }
+    static reg set1(double t) noexcept { return _mm256_set1_pd(t); }
+    static reg add(reg a, reg b) noexcept { return _mm256_add_pd(a, b); }
+    static reg sub(reg a, reg b) noexcept { return _mm256_sub_pd(a, b); }
+    static reg mul(reg a, reg b) noexcept { return _mm256_mul_pd(a, b); }
+    static reg div(reg a, reg b) noexcept { return _mm256_div_pd(a, b); }
+
+    // -a, by flipping the sign bits, which unlike 0 - a gives -0 for +0 as the scalar negation does.
+    static reg neg(reg a) noexcept { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+
+    // (y, z, x) and (z, x, y).
+    static reg yzx(reg a) noexcept { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1)); }
+    static reg zxy(reg a) noexcept { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 1, 0, 2)); }
+
+    // x + y + z, added in that order as the scalar code does.
+    static double sum3(reg a) noexcept {
+        const auto lo = _mm256_castpd256_pd128(a);
+        const auto z = _mm256_extractf128_pd(a, 1);
+        return _mm_cvtsd_f64(_mm_add_sd(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)), z));
+    }
+};
+#endif
+
+#if defined(RTWEEKEND_SIMD_VEC3) && defined(__SSE__)
+template<>
+struct vec3_lanes<float> final {
+    static constexpr bool enabled = true;
+    using reg = __m128;
+
+    static reg load(const float *p) noexcept { return _mm_load_ps(p); }
+    static void store(float *p, reg v) noexcept { _mm_store_ps(p, v); }
+    static reg set1(float t) noexcept { return _mm_set1_ps(t); }
+    static reg add(reg a, reg b) noexcept { return _mm_add_ps(a, b); }
+    static reg sub(reg a, reg b) noexcept { return _mm_sub_ps(a, b); }
+    static reg mul(reg a, reg b) noexcept { return _mm_mul_ps(a, b); }
+    static reg div(reg a, reg b) noexcept { return _mm_div_ps(a, b); }
+    static reg neg(reg a) noexcept { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+
+    static reg yzx(reg a) noexcept { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+    static reg zxy(reg a) noexcept { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2)); }
+
+    static float sum3(reg a) noexcept {
+        const auto y = _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1));
+        const auto z = _mm_movehl_ps(a, a);
+        return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(a, y), z));
+    }
+};
+#endif
+
+// A vector of three scalars of type T. The renderer uses vec3, whose scalar is real (see rtweekend.h); primitives
+// that need more precision than that convert to and from basic_vec3<double>.
+template<typename T>
+class basic_vec3 final {
 private:
-    const static double epsilon;
-    double e[3];
+    using lanes = vec3_lanes<T>;
+    static constexpr T epsilon = static_cast<T>(1e-8);
+    alignas(lanes::enabled ? 4 * sizeof(T) : alignof(T)) T e[lanes::enabled ? 4 : 3];
+
+    template<typename F>
+    [[nodiscard]] static basic_vec3 from(F &&f) noexcept {
+        basic_vec3 result;
+        lanes::store(result.e, f());
+        return result;
+    }
 
 public:
-    vec3() noexcept: e{0, 0, 0} {}
-    vec3(double e0, double e1, double e2) noexcept: e{e0, e1, e2} {}
+    using scalar = T;
+
+    basic_vec3() noexcept: e{0, 0, 0} {}
+
+    // Any arithmetic components, so that a vec3 of floats can be built from doubles.
+    template<typename A, typename B, typename C>
+    requires std::is_arithmetic_v<A> && std::is_arithmetic_v<B> && std::is_arithmetic_v<C>
+    basic_vec3(A e0, B e1, C e2) noexcept: e{static_cast<T>(e0), static_cast<T>(e1), static_cast<T>(e2)} {}
+
+    template<typename U>
+    explicit basic_vec3(const basic_vec3<U> &v) noexcept
+    : e{static_cast<T>(v.x()), static_cast<T>(v.y()), static_cast<T>(v.z())} {}
 
     [[nodiscard]] auto x() const noexcept { return e[0]; }
     [[nodiscard]] auto y() const noexcept { return e[1]; }
     [[nodiscard]] auto z() const noexcept { return e[2]; }
 
-    [[nodiscard]] auto operator-() const noexcept{ return vec3{-e[0], -e[1], -e[2]}; }
+    [[nodiscard]] auto operator-() const noexcept {
+        if constexpr (lanes::enabled)
+            return from([&] { return lanes::neg(lanes::load(e)); });
+        else
+            return basic_vec3{-e[0], -e[1], -e[2]};
+    }
     [[nodiscard]] auto operator[](int i) const { return e[i]; }
     [[nodiscard]] auto &operator[](int i) { return e[i]; }
 
-    [[nodiscard]] inline auto operator+(const vec3 &v) const noexcept {
-        return vec3{e[0] + v.e[0], e[1] + v.e[1], e[2] + v.e[2]};
+    [[nodiscard]] inline auto operator+(const basic_vec3 &v) const noexcept {
+        if constexpr (lanes::enabled)
+            return from([&] { return lanes::add(lanes::load(e), lanes::load(v.e)); });
+        else
+            return basic_vec3{e[0] + v.e[0], e[1] + v.e[1], e[2] + v.e[2]};
     }
 
-    [[nodiscard]] inline auto operator-(const vec3 &v) const noexcept {
-        return vec3{e[0] - v.e[0], e[1] - v.e[1], e[2] - v.e[2]};
+    [[nodiscard]] inline auto operator-(const basic_vec3 &v) const noexcept {
+        if constexpr (lanes::enabled)
+            return from([&] { return lanes::sub(lanes::load(e), lanes::load(v.e)); });
+        else
+            return basic_vec3{e[0] - v.e[0], e[1] - v.e[1], e[2] - v.e[2]};
     }
 
-    [[nodiscard]] inline auto operator*(const vec3 &v) const noexcept {
-        return vec3(e[0] * v.e[0], e[1] * v.e[1], e[2] * v.e[2]);
+    [[nodiscard]] inline auto operator*(const basic_vec3 &v) const noexcept {
+        if constexpr (lanes::enabled)
+            return from([&] { return lanes::mul(lanes::load(e), lanes::load(v.e)); });
+        else
+            return basic_vec3(e[0] * v.e[0], e[1] * v.e[1], e[2] * v.e[2]);
     }
 
-    [[nodiscard]] inline auto operator*(const double t) const noexcept {
-        return vec3(e[0] * t, e[1] * t, e[2] * t);
+    [[nodiscard]] inline auto operator*(const T t) const noexcept {
+        if constexpr (lanes::enabled)
+            return from([&] { return lanes::mul(lanes::load(e), lanes::set1(t)); });
+        else
+            return basic_vec3(e[0] * t, e[1] * t, e[2] * t);
     }
 
-    [[nodiscard]] inline auto operator/(const double t) const {
-        return vec3(e[0] / t, e[1] / t, e[2] / t);
+    [[nodiscard]] inline auto operator/(const T t) const {
+        if constexpr (lanes::enabled)
+            return from([&] { return lanes::div(lanes::load(e), lanes::set1(t)); });
+        else
+            return basic_vec3(e[0] / t, e[1] / t, e[2] / t);
     }
 
-    auto &operator+=(const vec3 &v) noexcept {
-        e[0] += v.e[0];
-        e[1] += v.e[1];
-        e[2] += v.e[2];
+    auto &operator+=(const basic_vec3 &v) noexcept {
+        if constexpr (lanes::enabled) {
+            lanes::store(e, lanes::add(lanes::load(e), lanes::load(v.e)));
+        } else {
+            e[0] += v.e[0];
+            e[1] += v.e[1];
+            e[2] += v.e[2];
+        }
         return *this;
     }
 
-    auto &operator*=(const double t) noexcept {
-        e[0] *= t;
-        e[1] *= t;
-        e[2] *= t;
+    auto &operator*=(const T t) noexcept {
+        if constexpr (lanes::enabled) {
+            lanes::store(e, lanes::mul(lanes::load(e), lanes::set1(t)));
+        } else {
+            e[0] *= t;
+            e[1] *= t;
+            e[2] *= t;
+        }
         return *this;
     }
 
-    auto &operator/=(const double t) {
+    auto &operator/=(const T t) {
         return *this *= 1/t;
     }
 
-    [[nodiscard]] inline auto dot(const vec3 &v) const noexcept {
-        return e[0] * v.e[0] + e[1] * v.e[1] + e[2] * v.e[2];
+    [[nodiscard]] inline auto dot(const basic_vec3 &v) const noexcept {
+        if constexpr (lanes::enabled)
+            return lanes::sum3(lanes::mul(lanes::load(e), lanes::load(v.e)));
+        else
+            return e[0] * v.e[0] + e[1] * v.e[1] + e[2] * v.e[2];
     }
 
-    [[nodiscard]] inline auto cross(const vec3 &v) const noexcept {
-        return vec3(e[1] * v.e[2] - e[2] * v.e[1],
-                    e[2] * v.e[0] - e[0] * v.e[2],
-                    e[0] * v.e[1] - e[1] * v.e[0]);
+    [[nodiscard]] inline auto cross(const basic_vec3 &v) const noexcept {
+        if constexpr (lanes::enabled) {
+            return from([&] {
+                const auto a = lanes::load(e);
+                const auto b = lanes::load(v.e);
+                return lanes::sub(lanes::mul(lanes::yzx(a), lanes::zxy(b)), lanes::mul(lanes::zxy(a), lanes::yzx(b)));
+            });
+        } else {
+            return basic_vec3(e[1] * v.e[2] - e[2] * v.e[1],
+                              e[2] * v.e[0] - e[0] * v.e[2],
+                              e[0] * v.e[1] - e[1] * v.e[0]);
+        }
     }
 
     [[nodiscard]] auto length_squared() const noexcept {
-        return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+        return dot(*this);
     }
 
     [[nodiscard]] auto length() const noexcept {
@@ -87,19 +216,23 @@ public:
     }
 
     [[nodiscard]] inline static auto random() noexcept {
-        return vec3{random_double(), random_double(), random_double()};
+        return basic_vec3{random_double(), random_double(), random_double()};
     }
 
     [[nodiscard]] inline static auto random(double min, double max) noexcept {
-        return vec3{random_double(min, max), random_double(min, max), random_double(min, max)};
+        return basic_vec3{random_double(min, max), random_double(min, max), random_double(min, max)};
+    }
+
+    [[nodiscard]] inline static auto random(rng &gen, double min, double max) noexcept {
+        return basic_vec3{random_double(gen, min, max), random_double(gen, min, max), random_double(gen, min, max)};
     }
 
     [[nodiscard]] bool near_zero() const noexcept {
-        return (fabs(e[0]) < epsilon) && (fabs(e[1]) < epsilon) && (fabs(e[2]) < epsilon);
+        return (std::fabs(e[0]) < epsilon) && (std::fabs(e[1]) < epsilon) && (std::fabs(e[2]) < epsilon);
     }
 };
 
-const double vec3::epsilon = 1e-8;
+using vec3 = basic_vec3<real>;
 
 // Type aliases for vec3.
 using point3 = vec3;
@@ -111,29 +244,32 @@ const color SKY_BLUE{0.5, 0.7, 1.0};
 const color GREY{0.5, 0.5, 0.5};
 
 // Utility functions
-inline auto &operator<<(std::ostream &out, const vec3 &v) {
+template<typename T>
+inline auto &operator<<(std::ostream &out, const basic_vec3<T> &v) {
     return out << v[0] << ' ' << v[1] << ' ' << v[2];
 }
 
-[[nodiscard]] inline auto operator*(const double t, const vec3 &v) {
+// The scalar converts to the type of the vector, so that doubles scale vectors of floats.
+template<typename T>
+[[nodiscard]] inline auto operator*(const std::type_identity_t<T> t, const basic_vec3<T> &v) {
     return v * t;
 }
 
-[[nodiscard]] auto random_in_unit_sphere() noexcept {
+[[nodiscard]] auto random_in_unit_sphere(rng &gen) noexcept {
     while (true) {
-        auto p = vec3::random(-1, 1);
+        auto p = vec3::random(gen, -1, 1);
         if (p.length_squared() >= 1)
             continue;
         return p;
     }
 }
 
-[[nodiscard]] auto random_unit_vector() noexcept {
-    return random_in_unit_sphere().unit_vector();
+[[nodiscard]] auto random_unit_vector(rng &gen) noexcept {
+    return random_in_unit_sphere(gen).unit_vector();
 }
 
-[[nodiscard]] auto random_in_hemisphere(const vec3 &normal) noexcept {
-    auto in_unit_sphere = random_in_unit_sphere();
+[[nodiscard]] auto random_in_hemisphere(const vec3 &normal, rng &gen) noexcept {
+    auto in_unit_sphere = random_in_unit_sphere(gen);
     return in_unit_sphere.dot(normal) > 0.0 ? in_unit_sphere : -in_unit_sphere;
 }
 
@@ -148,9 +284,9 @@ inline auto &operator<<(std::ostream &out, const vec3 &v) {
     return r_out_perp + r_out_parallel;
 }
 
-[[nodiscard]] auto random_in_unit_disk() {
+[[nodiscard]] auto random_in_unit_disk(rng &gen) noexcept {
     while (true) {
-        const auto p = vec3{random_double(-1, 1), random_double(-1, 1), 0};
+        const auto p = vec3{random_double(gen, -1, 1), random_double(gen, -1, 1), 0};
         if (p.length_squared() >= 1)
             continue;
         return p;
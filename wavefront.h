@@ -0,0 +1,160 @@
+/**
+ * wavefront.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+
+#include "rtweekend.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "lights.h"
+#include "material.h"
+#include "material_table.h"
+#include "packet.h"
+
+// One path for the wavefront tracer: its camera ray, sample stream and sample point in, its radiance out.
+struct wavefront_path final {
+    ray r;
+    rng gen;
+    sample_point point{};
+    color radiance{0, 0, 0};
+};
+
+// A wavefront (streaming) path tracer. Rather than following each path to completion, it advances a whole batch of
+// paths one bounce at a time in stages: intersect every live ray in packets, retire the misses and compact the
+// survivors, bin the hits by material type, shade each bin with one material's scatter, queueing the shadow rays of
+// the light samples, and then trace those shadow rays before moving on to the next bounce.
+// Each stage runs a single kind of work over many paths, which keeps the instruction and data caches warm and leaves
+// room for batched shading.
+//
+// Each path draws from its own stream in the same order as trace_path, and each shadow ray from a stream that its
+// light sample seeds, so both produce identical results.
+class wavefront_tracer final {
+private:
+    const hittable &world;
+    const color background;
+    const path_limits limits;
+    const light_list *lights;
+    const bool mis;
+
+    // Per-path state, indexed like the batch.
+    std::vector<path_state> states;
+    std::vector<hit_record> hits;
+
+    // Indices of the live paths, and the same paths regrouped by material type.
+    std::vector<std::uint32_t> active;
+    std::vector<std::uint32_t> next;
+    std::vector<std::uint32_t> binned;
+
+    // The classes of the polymorphic materials seen so far, the bin of each path, and where each bin starts in binned.
+    // The built-in material kinds have the first bins, and the polymorphic classes follow.
+    std::vector<std::type_index> types;
+    std::vector<std::uint32_t> bin_of;
+    std::vector<std::uint32_t> bin_start;
+
+    ray_packet packet;
+
+    // The shadow rays queued while shading a bounce, and the paths they belong to.
+    std::vector<shadow_ray> shadows;
+    std::vector<std::uint32_t> shadow_paths;
+    shadow_ray shadow;
+
+    static constexpr auto kinds = static_cast<std::uint32_t>(material_kind::polymorphic);
+
+    [[nodiscard]] std::uint32_t type_bin(const material_record &m) {
+        if (m.kind != material_kind::polymorphic)
+            return static_cast<std::uint32_t>(m.kind);
+        const std::type_index type{typeid(*m.object)};
+        for (std::uint32_t b = 0; b < types.size(); ++b)
+            if (types[b] == type)
+                return kinds + b;
+        types.emplace_back(type);
+        return kinds + static_cast<std::uint32_t>(types.size() - 1);
+    }
+
+public:
+    wavefront_tracer(const hittable &world,
+                     const color &background,
+                     const path_limits &limits,
+                     const light_list *lights = nullptr,
+                     bool mis = true) noexcept
+    : world{world}, background{background}, limits{limits}, lights{lights}, mis{mis} {}
+
+    void trace(std::vector<wavefront_path> &paths, path_stats &stats) {
+        const auto n = paths.size();
+        states.assign(n, {});
+        hits.resize(n);
+        bin_of.resize(n);
+        binned.resize(n);
+
+        active.resize(n);
+        for (std::uint32_t k = 0; k < n; ++k)
+            active[k] = k;
+        stats.paths += n;
+
+        for (auto depth = 0; depth < limits.max_depth && !active.empty(); ++depth) {
+            // Intersect every live ray, a packet at a time. Misses gather the background and leave the wavefront.
+            stats.rays += active.size();
+            next.clear();
+            for (std::size_t start = 0; start < active.size(); start += ray_packet::size) {
+                const auto end = std::min(active.size(), start + ray_packet::size);
+                packet.clear();
+                for (auto idx = start; idx < end; ++idx)
+                    packet.add(paths[active[idx]].r, paths[active[idx]].gen, hits[active[idx]], infinity);
+
+                const auto hit = world.hit_packet(packet, packet.lanes(), ray_t_min);
+                for (auto idx = start; idx < end; ++idx) {
+                    const auto k = active[idx];
+                    if (hit & (1u << (idx - start)))
+                        next.emplace_back(k);
+                    else
+                        paths[k].radiance += states[k].throughput * background;
+                }
+            }
+            std::swap(active, next);
+
+            // Counting sort of the survivors by material type.
+            for (const auto k: active)
+                bin_of[k] = type_bin(scene_materials[hits[k].mat]);
+            bin_start.assign(kinds + types.size() + 1, 0);
+            for (const auto k: active)
+                ++bin_start[bin_of[k] + 1];
+            for (std::size_t b = 1; b < bin_start.size(); ++b)
+                bin_start[b] += bin_start[b - 1];
+            for (const auto k: active)
+                binned[bin_start[bin_of[k]]++] = k;
+
+            // Shade one material type at a time. The paths that scatter form the next wavefront.
+            next.clear();
+            for (std::size_t idx = 0; idx < active.size(); ++idx) {
+                const auto k = binned[idx];
+                auto &path = paths[k];
+
+                // Queue the shadow ray of a light sample, to be traced with the others once the bin is shaded.
+                const auto result = shade_vertex(path.r, hits[k], depth, states[k], path.radiance, shadow, limits,
+                                                 lights, mis, &path.point, path.gen);
+                if (result.shadow) {
+                    shadows.emplace_back(shadow);
+                    shadow_paths.emplace_back(k);
+                }
+                if (result.next)
+                    next.emplace_back(k);
+            }
+            std::swap(active, next);
+
+            // Trace the queued shadow rays, and gather the light of those that reach their lights.
+            for (std::size_t idx = 0; idx < shadows.size(); ++idx)
+                if (!light_list::occluded(world, shadows[idx]))
+                    paths[shadow_paths[idx]].radiance += shadows[idx].light;
+            shadows.clear();
+            shadow_paths.clear();
+        }
+    }
+};
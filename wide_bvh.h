@@ -0,0 +1,257 @@
+/**
+ * wide_bvh.h
+ * By Sebastian Raaphorst, 2023.
+ */
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+
+// A BVH with up to Width (4 or 8) children per node, collapsed from a binary linear_bvh. The bounds of a node's
+// children are stored as structure-of-arrays, so one ray is tested against all of them in a single SIMD slab test,
+// and the children it hits are visited nearest first. Children that a closer hit has since put out of reach are
+// skipped without being tested again.
+//
+// This suits incoherent rays, such as diffuse bounces, which packets cannot help: every ray gets the full width of the
+// SIMD unit to itself.
+template<int Width>
+class wide_bvh final : public hittable {
+public:
+    static_assert(Width == 4 || Width == 8, "wide_bvh nodes have 4 or 8 children");
+
+    struct node final {
+        // The bounds of the children, one array per axis. Unused slots hold empty boxes, which no ray hits.
+        alignas(64) std::array<std::array<double, Width>, 3> minimum;
+        alignas(64) std::array<std::array<double, Width>, 3> maximum;
+
+        // For a leaf child, its first primitive and the number of its primitives. For an interior child, the index of
+        // its node and a count of 0.
+        std::array<std::uint32_t, Width> offset{};
+        std::array<std::uint16_t, Width> count{};
+    };
+
+    std::vector<node> nodes;
+    std::vector<std::shared_ptr<hittable>> primitives;
+
+    // Collapse a binary BVH: starting from the two children of each binary node, the child with the largest surface
+    // area is repeatedly replaced by its own two children until the wide node is full or holds only leaves.
+    explicit wide_bvh(const linear_bvh &binary) : primitives{binary.primitives} {
+        if (binary.nodes.front().count > 0)
+            collapse(binary, {0});
+        else
+            collapse(binary, {1, binary.nodes.front().offset});
+        nodes.shrink_to_fit();
+    }
+
+    [[nodiscard]] bool bounding_box(double time0, double time1, aabb &output_box) const noexcept override {
+        output_box = aabb{point3{infinity, infinity, infinity}, point3{-infinity, -infinity, -infinity}};
+        const auto &root = nodes.front();
+        for (auto k = 0; k < Width; ++k)
+            if (root.minimum[0][k] <= root.maximum[0][k])
+                output_box = surrounding_box(output_box,
+                                             aabb{point3{root.minimum[0][k], root.minimum[1][k], root.minimum[2][k]},
+                                                  point3{root.maximum[0][k], root.maximum[1][k], root.maximum[2][k]}});
+        return true;
+    }
+
+    [[nodiscard]] bool hit(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept override {
+        return traverse(r, t_min, t_max, rec, gen);
+    }
+
+    [[nodiscard]] bool occluded(const ray &r, double t_min, double t_max, rng &gen) const noexcept override {
+        hit_record unused;
+        return traverse<true>(r, t_min, t_max, unused, gen);
+    }
+
+private:
+    // Any-hit traversals return at the first primitive that occludes the ray, and leave rec alone.
+    template<bool AnyHit = false>
+    [[nodiscard]] bool traverse(const ray &r, double t_min, double t_max, hit_record &rec, rng &gen) const noexcept {
+        // As in aabb::hit, which also decides the order of the slabs by the sign of the reciprocal.
+        std::array<double, 3> inv_dir;
+        std::array<bool, 3> negative;
+        for (auto a = 0; a < 3; ++a) {
+            inv_dir[a] = 1.0 / r.direction()[a];
+            negative[a] = inv_dir[a] < 0;
+        }
+        const std::array<double, 3> org{r.origin().x(), r.origin().y(), r.origin().z()};
+
+        // The children still to visit, with the distances at which the ray enters them.
+        struct entry final {
+            std::uint32_t offset;
+            std::uint16_t count;
+            double t_near;
+        };
+        std::array<entry, linear_bvh::max_depth * (Width - 1) + 1> stack;
+        auto top = 0;
+        stack[top++] = {0, 0, t_min};
+
+        alignas(64) std::array<double, Width> t_near;
+        auto hit_anything = false;
+        while (top > 0) {
+            const auto e = stack[--top];
+            if (e.t_near >= t_max)
+                continue;
+
+            if (e.count > 0) {
+                for (auto p = e.offset; p < e.offset + e.count; ++p) {
+                    if constexpr (AnyHit) {
+                        if (primitives[p]->occluded(r, t_min, t_max, gen))
+                            return true;
+                    } else if (primitives[p]->hit(r, t_min, t_max, rec, gen)) {
+                        hit_anything = true;
+                        t_max = rec.t;
+                    }
+                }
+                continue;
+            }
+
+            const auto &n = nodes[e.offset];
+            auto mask = slabs(n, org, inv_dir, negative, t_min, t_max, t_near.data());
+            if (!mask)
+                continue;
+
+            // Push the children hit farthest first, so that the nearest is popped first.
+            std::array<int, Width> order;
+            auto hits = 0;
+            for (; mask; mask &= mask - 1) {
+                const auto k = std::countr_zero(mask);
+                auto pos = hits++;
+                for (; pos > 0 && t_near[order[pos - 1]] < t_near[k]; --pos)
+                    order[pos] = order[pos - 1];
+                order[pos] = k;
+            }
+            for (auto h = 0; h < hits; ++h) {
+                const auto k = order[h];
+                stack[top++] = {n.offset[k], n.count[k], t_near[k]};
+            }
+        }
+
+        return hit_anything;
+    }
+
+    // The children of n that the ray hits within [t_min, t_max], as a bit mask, with the distances at which it enters
+    // them. Lane for lane, this is the slab test of aabb::hit.
+    [[nodiscard]] static std::uint32_t slabs(const node &n,
+                                             const std::array<double, 3> &org,
+                                             const std::array<double, 3> &inv_dir,
+                                             const std::array<bool, 3> &negative,
+                                             double t_min,
+                                             double t_max,
+                                             double *t_near) noexcept {
+        std::uint32_t mask = 0;
+
+#if defined(__AVX512F__)
+        if constexpr (Width == 8) {
+            auto near = _mm512_set1_pd(t_min);
+            auto far = _mm512_set1_pd(t_max);
+            for (auto a = 0; a < 3; ++a) {
+                const auto o = _mm512_set1_pd(org[a]);
+                const auto inv = _mm512_set1_pd(inv_dir[a]);
+                const auto t0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_load_pd(n.minimum[a].data()), o), inv);
+                const auto t1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_load_pd(n.maximum[a].data()), o), inv);
+                near = _mm512_max_pd(negative[a] ? t1 : t0, near);
+                far = _mm512_min_pd(negative[a] ? t0 : t1, far);
+            }
+            _mm512_store_pd(t_near, near);
+            return _mm512_cmp_pd_mask(far, near, _CMP_GT_OQ);
+        }
+#endif
+
+#if defined(__AVX__)
+        for (auto base = 0; base < Width; base += 4) {
+            auto near = _mm256_set1_pd(t_min);
+            auto far = _mm256_set1_pd(t_max);
+            for (auto a = 0; a < 3; ++a) {
+                const auto o = _mm256_set1_pd(org[a]);
+                const auto inv = _mm256_set1_pd(inv_dir[a]);
+                const auto t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_load_pd(n.minimum[a].data() + base), o), inv);
+                const auto t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_load_pd(n.maximum[a].data() + base), o), inv);
+                near = _mm256_max_pd(negative[a] ? t1 : t0, near);
+                far = _mm256_min_pd(negative[a] ? t0 : t1, far);
+            }
+            _mm256_store_pd(t_near + base, near);
+            mask |= static_cast<std::uint32_t>(_mm256_movemask_pd(_mm256_cmp_pd(far, near, _CMP_GT_OQ))) << base;
+        }
+#else
+        for (auto k = 0; k < Width; ++k) {
+            auto near = t_min;
+            auto far = t_max;
+            for (auto a = 0; a < 3; ++a) {
+                auto t0 = (n.minimum[a][k] - org[a]) * inv_dir[a];
+                auto t1 = (n.maximum[a][k] - org[a]) * inv_dir[a];
+                if (negative[a])
+                    std::swap(t0, t1);
+                near = t0 > near ? t0 : near;
+                far = t1 < far ? t1 : far;
+            }
+            t_near[k] = near;
+            if (far > near)
+                mask |= 1u << k;
+        }
+#endif
+
+        return mask;
+    }
+
+    std::uint32_t collapse(const linear_bvh &binary, std::vector<std::uint32_t> children) {
+        const auto &bin = binary.nodes;
+        while (children.size() < Width) {
+            auto widest = -1;
+            auto widest_area = -1.0;
+            for (std::size_t c = 0; c < children.size(); ++c) {
+                const auto &n = bin[children[c]];
+                if (n.count == 0 && n.box.surface_area() > widest_area) {
+                    widest = static_cast<int>(c);
+                    widest_area = n.box.surface_area();
+                }
+            }
+            if (widest < 0)
+                break;
+
+            // Its children take its place, in order, so the slots stay sorted along the split axes.
+            const auto opened = children[widest];
+            children[widest] = opened + 1;
+            children.insert(children.begin() + widest + 1, bin[opened].offset);
+        }
+
+        const auto index = static_cast<std::uint32_t>(nodes.size());
+        nodes.emplace_back();
+        for (auto a = 0; a < 3; ++a) {
+            nodes[index].minimum[a].fill(infinity);
+            nodes[index].maximum[a].fill(-infinity);
+        }
+
+        for (std::size_t k = 0; k < children.size(); ++k) {
+            const auto &child = bin[children[k]];
+            for (auto a = 0; a < 3; ++a) {
+                nodes[index].minimum[a][k] = child.box.minimum[a];
+                nodes[index].maximum[a][k] = child.box.maximum[a];
+            }
+
+            if (child.count > 0) {
+                nodes[index].offset[k] = child.offset;
+                nodes[index].count[k] = child.count;
+            } else {
+                const auto grandchild = collapse(binary, {children[k] + 1, child.offset});
+                nodes[index].offset[k] = grandchild;
+            }
+        }
+
+        return index;
+    }
+};